@@ -0,0 +1,44 @@
+#ifndef ATOM_LAYOUT_H
+#define ATOM_LAYOUT_H
+
+#include "platformDefines.h"
+#include "simContext.h"
+#include "precision.h"
+
+// Expected photon distribution of a single atom at brightness one, cropped to the camera pixels it reaches
+typedef struct SiteFootprint
+{
+    int x;
+    int y;
+    int width;          // Zero if the site is outside of the field of view
+    int height;
+    real *values;
+} siteFootprint;
+
+typedef struct AtomLayout
+{
+    double (*sites)[2];
+    unsigned int siteCount;
+    unsigned short cameraCoords;
+    unsigned int approximationSteps;
+    siteFootprint *footprints;
+
+    // Settings the footprints were computed with
+    int resolutionX;
+    int resolutionY;
+    double pixelSize;
+    double numericalAperture;
+    double wavelength;
+    double lightSourceStdev;
+    double lightSourceCutoff;
+    int pixelIntegration;
+    double zernikeCoefficients[15];
+} atomLayout;
+
+EXPORT atomLayout *prepareAtomLayout(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT atomLayout *prepareAtomLayoutCtx(SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void freeAtomLayout(atomLayout *layout);
+atomLayout *copyAtomLayout(const atomLayout *layout);
+void updateAtomLayout(SimContext *context, atomLayout *layout);
+
+#endif
\ No newline at end of file
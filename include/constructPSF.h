@@ -1,4 +1,7 @@
 #include "platformDefines.h"
+#include "settings.h"
 
 EXPORT void getPSF(double *psf, int numPixels);
-EXPORT void getConvolutedLightSource(double *psf, int numPixels);
\ No newline at end of file
+EXPORT void getConvolutedLightSource(double *psf, int numPixels);
+EXPORT void getPSFCtx(SimContext *context, double *psf, int numPixels);
+EXPORT void getConvolutedLightSourceCtx(SimContext *context, double *psf, int numPixels);
\ No newline at end of file
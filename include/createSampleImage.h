@@ -1,4 +1,33 @@
 #include "platformDefines.h"
+#include "simContext.h"
+#include "atomLayout.h"
 
-EXPORT void createImageEMCCD(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, int atomCount, int approximationSteps);
-EXPORT void createImageCMOS(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, int atomCount, int approximationSteps);
\ No newline at end of file
+EXPORT void createImageEMCCD(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void createImageCMOS(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void createImageEMCCDFromLayout(int *binnedImage, atomLayout *layout, double *truth);
+EXPORT void createImageCMOSFromLayout(int *binnedImage, atomLayout *layout, double *truth);
+EXPORT void createImageEMCCDCtx(SimContext *context, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void createImageCMOSCtx(SimContext *context, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void createImageEMCCDFromLayoutCtx(SimContext *context, int *binnedImage, atomLayout *layout, double *truth);
+EXPORT void createImageCMOSFromLayoutCtx(SimContext *context, int *binnedImage, atomLayout *layout, double *truth);
+EXPORT void createImagesEMCCDBatch(int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount);
+EXPORT void createImagesCMOSBatch(int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount);
+EXPORT void createImagesEMCCDFromLayoutBatch(int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount);
+EXPORT void createImagesCMOSFromLayoutBatch(int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount);
+EXPORT void createImagesEMCCDBatchCtx(SimContext *context, int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount);
+EXPORT void createImagesCMOSBatchCtx(SimContext *context, int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount);
+EXPORT void createImagesEMCCDFromLayoutBatchCtx(SimContext *context, int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount);
+EXPORT void createImagesCMOSFromLayoutBatchCtx(SimContext *context, int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount);
+EXPORT void reserveWorkspace(unsigned int potentialAtomCount, unsigned int approximationSteps);
+EXPORT void reserveWorkspaceCtx(SimContext *context, unsigned int potentialAtomCount, unsigned int approximationSteps);
+void normalizeCameraCoords(const SimContext *context, double normalizedAtomLocations[][2], double atomLocations[][2], int atomCount, unsigned short cameraCoords);
+
+// Stages of a frame, used by the benchmark
+void initImageAndSimulateOpticalEffects(SimContext *context, uint64_t frameIndex, real *image, int imageHeight, int imageWidth, const double atomLocations[][2], 
+    const unsigned int *siteIndices, double *truth, int atomCount, int approximationSteps);
+double fillAtomLocations(SimContext *context, uint64_t frameIndex, const double potentialAtomLocations[][2], unsigned int potentialAtomCount, 
+    double (**filledAtomLocations)[2], unsigned int **siteIndices, double *truth);
+void samplePhotonsEMCCD(SimContext *context, uint64_t frameIndex, real *image, int rowStride, int imageHeight, int imageWidth, int approximationSteps);
+void readoutEMCCD(SimContext *context, uint64_t frameIndex, int *binnedImage, const real *image, int rowStride, int approximationSteps);
+int sampleSCICElectrons(SimContext *context, randomStream *random);
+void sampleAndReadoutCMOS(SimContext *context, uint64_t frameIndex, int *binnedImage, const real *image, int rowStride, int approximationSteps);
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef DATASET_WRITER_H
+#define DATASET_WRITER_H
+
+#include <stdint.h>
+#include "platformDefines.h"
+#include "simContext.h"
+#include "atomLayout.h"
+
+typedef struct DatasetWriter datasetWriter;
+
+EXPORT datasetWriter *openDataset(const char *imagePath, const char *truthPath, int frameHeight, int frameWidth, unsigned int truthLength, uint64_t capacity);
+EXPORT void closeDataset(datasetWriter *dataset);
+EXPORT uint64_t getDatasetFrameCount(const datasetWriter *dataset);
+EXPORT int *reserveDatasetFrames(datasetWriter *dataset, uint64_t frameCount, double **truths);
+EXPORT void commitDatasetFrames(datasetWriter *dataset, uint64_t frameCount);
+EXPORT int appendDatasetEMCCD(datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount);
+EXPORT int appendDatasetCMOS(datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount);
+EXPORT int appendDatasetEMCCDFromLayout(datasetWriter *dataset, atomLayout *layout, uint64_t frameCount);
+EXPORT int appendDatasetCMOSFromLayout(datasetWriter *dataset, atomLayout *layout, uint64_t frameCount);
+
+EXPORT int appendDatasetEMCCDCtx(SimContext *context, datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount);
+EXPORT int appendDatasetCMOSCtx(SimContext *context, datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount);
+EXPORT int appendDatasetEMCCDFromLayoutCtx(SimContext *context, datasetWriter *dataset, atomLayout *layout, uint64_t frameCount);
+EXPORT int appendDatasetCMOSFromLayoutCtx(SimContext *context, datasetWriter *dataset, atomLayout *layout, uint64_t frameCount);
+
+#endif
\ No newline at end of file
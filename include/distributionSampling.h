@@ -1,9 +1,44 @@
+#ifndef DISTRIBUTION_SAMPLING_H
+#define DISTRIBUTION_SAMPLING_H
+
+#include <stdint.h>
 #include "platformDefines.h"
 
-EXPORT double randomZeroToOne();
-EXPORT double sampleGaussian(double mean, double stdev);
-EXPORT int samplePoisson(double lambda);
-EXPORT int sampleEMGain(int primary, double emGain);
-EXPORT double sampleTimeOfAtomLossImaging(double survivalProbability);
-EXPORT double sampleGamma(double shape, double rate);
-EXPORT double sampleGumbel(double location, double scale);
\ No newline at end of file
+// Independent sub-streams of a frame, the index meaning depends on the domain
+typedef enum RandomDomain
+{
+    RANDOM_DOMAIN_OCCUPANCY,      // index: atom site
+    RANDOM_DOMAIN_BRIGHTNESS,     // index: atom site
+    RANDOM_DOMAIN_PHOTONS,        // index: pixel of the sampled image, camera pixel for CMOS
+    RANDOM_DOMAIN_GAIN,           // index: binned pixel
+    RANDOM_DOMAIN_READOUT,        // index: camera row
+    RANDOM_DOMAIN_ROW_NOISE,      // index: camera row
+    RANDOM_DOMAIN_COLUMN_NOISE    // index: 0
+} randomDomain;
+
+/*
+ * Counter-based Philox4x32-10 stream, https://doi.org/10.1145/2063384.2063405
+ * The draws only depend on (seed, frame index, domain, index), so any subset of
+ * frames or pixels can be generated in any order and on any thread
+ */
+typedef struct RandomStream
+{
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint64_t buffer[2];
+    int buffered;
+} randomStream;
+
+EXPORT void initRandomStream(randomStream *random, uint64_t seed, uint64_t frameIndex, randomDomain domain, uint32_t index);
+EXPORT double randomZeroToOne(randomStream *random);
+EXPORT void fillUniform(randomStream *random, double *values, int count);
+EXPORT void fillGaussian(randomStream *random, double *values, int count, double mean, double stdev);
+EXPORT void fillGumbel(randomStream *random, double *values, int count, double location, double scale);
+EXPORT double sampleGaussian(randomStream *random, double mean, double stdev);
+EXPORT int samplePoisson(randomStream *random, double lambda);
+EXPORT int sampleEMGain(randomStream *random, int primary, double emGain);
+EXPORT double sampleTimeOfAtomLossImaging(randomStream *random, double survivalProbability);
+EXPORT double sampleGamma(randomStream *random, double shape, double rate);
+EXPORT double sampleGumbel(randomStream *random, double location, double scale);
+
+#endif
\ No newline at end of file
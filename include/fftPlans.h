@@ -0,0 +1,21 @@
+#ifndef FFT_PLANS_H
+#define FFT_PLANS_H
+
+#include "precision.h"
+#include "platformDefines.h"
+
+typedef enum FFTPlanKind
+{
+    FFT_FORWARD,
+    FFT_BACKWARD,
+    FFT_REAL_TO_COMPLEX,    // Half spectrum of height * (width / 2 + 1) values
+    FFT_COMPLEX_TO_REAL
+} fftPlanKind;
+
+fftPlan getFFTPlan(fftPlanKind kind, int height, int width);
+int getFFTFriendlySize(int minimumSize);
+EXPORT void setFFTPlanningRigor(int level);
+EXPORT int exportWisdom(const char *path);
+EXPORT int importWisdom(const char *path);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef FRAME_PRODUCER_H
+#define FRAME_PRODUCER_H
+
+#include <stdint.h>
+#include "platformDefines.h"
+#include "simContext.h"
+#include "atomLayout.h"
+
+typedef struct FrameProducer frameProducer;
+
+EXPORT frameProducer *createFrameProducerEMCCD(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerCMOS(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerEMCCDFromLayout(atomLayout *layout, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerCMOSFromLayout(atomLayout *layout, unsigned int batchSize, int depth, int threadCount);
+EXPORT void freeFrameProducer(frameProducer *producer);
+EXPORT int *acquireFrameBatch(frameProducer *producer, double **truths, uint64_t *firstFrameIndex);
+EXPORT void releaseFrameBatch(frameProducer *producer);
+
+EXPORT frameProducer *createFrameProducerEMCCDCtx(const SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerCMOSCtx(const SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerEMCCDFromLayoutCtx(const SimContext *context, atomLayout *layout, unsigned int batchSize, int depth, int threadCount);
+EXPORT frameProducer *createFrameProducerCMOSFromLayoutCtx(const SimContext *context, atomLayout *layout, unsigned int batchSize, int depth, int threadCount);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Wall time per stage and counts of random draws, summed over the frames of a call and over the threads of batches
+ * Only recorded if the library is built with NAIS_STATS (make STATS=1), otherwise all values stay zero
+ */
+typedef struct FrameStats
+{
+    uint64_t frames;
+    double frameSeconds;
+    double lightSourceSeconds;  // Drawing the atoms onto the image, or adding the footprints of a layout
+    double opticsSeconds;       // Everything in simulateOptics
+    double fftSeconds;          // Forward and inverse transforms within simulateOptics
+    double photonSeconds;       // Photon sampling of EMCCD frames, CMOS samples the photons in the readout pass
+    double readoutSeconds;      // Binning, EM gain, sCIC and readout noise, for CMOS also the photon sampling
+    uint64_t poissonDraws;
+    uint64_t emGainSamples;     // Draws of the gain register output, including those of sCIC charges
+    uint64_t sCICEvents;
+} frameStats;
+
+#ifdef NAIS_STATS
+    #include "platformTime.h"
+    #define STATS_START_TIMER(name) double name = getMonotonicSeconds()
+    #define STATS_ADD_TIME(context, field, start) ((context)->lastFrameStats.field += getMonotonicSeconds() - (start))
+    #define STATS_COUNT(context, field, count) ((context)->lastFrameStats.field += (count))
+    #define STATS_BEGIN_CALL(context) ((context)->lastFrameStats = (frameStats){0})
+    #define STATS_END_CALL(context) addFrameStats(&(context)->cumulativeStats, &(context)->lastFrameStats)
+#else
+    #define STATS_START_TIMER(name)
+    #define STATS_ADD_TIME(context, field, start)
+    #define STATS_COUNT(context, field, count)
+    #define STATS_BEGIN_CALL(context)
+    #define STATS_END_CALL(context)
+#endif
+
+void addFrameStats(frameStats *total, const frameStats *stats);
+
+#endif
\ No newline at end of file
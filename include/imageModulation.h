@@ -1,2 +1,28 @@
-void simulateOptics(double *inputImage, int imageHeight, int imageWidth, double effectivePixelSize, double photonsPerAtom);
-double ZernikePhase(double r, double u, const double zernikeCoefficients[15]);
\ No newline at end of file
+#ifndef IMAGE_MODULATION_H
+#define IMAGE_MODULATION_H
+
+#include "simContext.h"
+
+// Zero-padded image the optical convolution is computed on, the visible image of the camera lies at the offsets
+typedef struct OpticsGrid
+{
+    int height;
+    int width;
+    int offsetY;
+    int offsetX;
+} opticsGrid;
+
+opticsGrid getOpticsGrid(const SimContext *context, int approximationSteps);
+void simulateOptics(SimContext *context, real *inputImage, int imageHeight, int imageWidth, double effectivePixelSize, double lightSourceStdev, double photonsPerAtom);
+void reserveOpticsWorkspace(workspace *workspace, int imageHeight, int imageWidth);
+void prepareOptics(SimContext *context, int imageHeight, int imageWidth, double effectivePixelSize);
+void invalidateOpticalTransferFunction(SimContext *context);
+double getPhotonsPerAtom(const SimContext *context);
+double getPointSourceSpread(const SimContext *context, double effectivePixelSize);
+EXPORT int usesExactPointSources(unsigned int approximationSteps);
+EXPORT int usesExactPointSourcesCtx(const SimContext *context, unsigned int approximationSteps);
+void addLightSource(real *image, int imageHeight, int imageWidth, double x, double y, double brightness, double stdev, double pointSpread);
+void fillPupil(SimContext *context, zernikeBasisCache *cache, fftComplex *pupil, int imageHeight, int imageWidth, int centerY, int centerX, double yFactor, double xFactor, double pupilRadius);
+double ZernikePhase(double r, double u, const double zernikeCoefficients[15]);
+
+#endif
\ No newline at end of file
@@ -4,4 +4,11 @@
     #define EXPORT __attribute__((visibility("default")))
 #else
     #error Unknown compiler
+#endif
+
+// Kernels that profit from wider vector units get AVX2 and AVX-512 versions selected at load time where the toolchain supports it
+#if defined(__GNUC__) && !defined(__clang__) && !defined(_WIN32) && defined(__x86_64__)
+    #define SIMD_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+    #define SIMD_TARGET_CLONES
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+#ifndef PLATFORM_FILES_H
+#define PLATFORM_FILES_H
+
+#include <stdint.h>
+
+// Read-write memory mapping of a whole file, the size is given by the file and changed with resizeMappedFile
+#if defined(_WIN32)
+    #include <windows.h>
+    typedef struct MappedFile
+    {
+        HANDLE file;
+        HANDLE mapping;
+        unsigned char *data;
+        uint64_t size;
+    } mappedFile;
+
+    static inline int mapWholeFile(mappedFile *file)
+    {
+        file->mapping = NULL;
+        file->data = NULL;
+        if(!file->size)
+        {
+            return 1;
+        }
+        file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READWRITE, (DWORD)(file->size >> 32), (DWORD)file->size, NULL);
+        if(!file->mapping)
+        {
+            return 0;
+        }
+        file->data = MapViewOfFile(file->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        return file->data != NULL;
+    }
+
+    static inline void unmapWholeFile(mappedFile *file)
+    {
+        if(file->data)
+        {
+            UnmapViewOfFile(file->data);
+        }
+        if(file->mapping)
+        {
+            CloseHandle(file->mapping);
+        }
+        file->data = NULL;
+        file->mapping = NULL;
+    }
+
+    static inline int openMappedFile(mappedFile *file, const char *path)
+    {
+        file->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER size;
+        if(file->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->file, &size))
+        {
+            return 0;
+        }
+        file->size = size.QuadPart;
+        return mapWholeFile(file);
+    }
+
+    static inline int resizeMappedFile(mappedFile *file, uint64_t size)
+    {
+        unmapWholeFile(file);
+        LARGE_INTEGER position;
+        position.QuadPart = size;
+        if(!SetFilePointerEx(file->file, position, NULL, FILE_BEGIN) || !SetEndOfFile(file->file))
+        {
+            return 0;
+        }
+        file->size = size;
+        return mapWholeFile(file);
+    }
+
+    // Starts writing the changes back without waiting for them
+    static inline void flushMappedFile(mappedFile *file)
+    {
+        if(file->data)
+        {
+            FlushViewOfFile(file->data, 0);
+        }
+    }
+
+    static inline void closeMappedFile(mappedFile *file)
+    {
+        flushMappedFile(file);
+        unmapWholeFile(file);
+        FlushFileBuffers(file->file);
+        CloseHandle(file->file);
+    }
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    typedef struct MappedFile
+    {
+        int descriptor;
+        unsigned char *data;
+        uint64_t size;
+    } mappedFile;
+
+    static inline int mapWholeFile(mappedFile *file)
+    {
+        file->data = NULL;
+        if(!file->size)
+        {
+            return 1;
+        }
+        void *data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, file->descriptor, 0);
+        if(data == MAP_FAILED)
+        {
+            return 0;
+        }
+        file->data = data;
+        return 1;
+    }
+
+    static inline void unmapWholeFile(mappedFile *file)
+    {
+        if(file->data)
+        {
+            munmap(file->data, file->size);
+        }
+        file->data = NULL;
+    }
+
+    static inline int openMappedFile(mappedFile *file, const char *path)
+    {
+        file->data = NULL;
+        file->descriptor = open(path, O_RDWR | O_CREAT, 0644);
+        struct stat status;
+        if(file->descriptor < 0 || fstat(file->descriptor, &status))
+        {
+            return 0;
+        }
+        file->size = status.st_size;
+        return mapWholeFile(file);
+    }
+
+    static inline int resizeMappedFile(mappedFile *file, uint64_t size)
+    {
+        unmapWholeFile(file);
+        if(ftruncate(file->descriptor, size))
+        {
+            return 0;
+        }
+        file->size = size;
+        return mapWholeFile(file);
+    }
+
+    // Starts writing the changes back without waiting for them
+    static inline void flushMappedFile(mappedFile *file)
+    {
+        if(file->data)
+        {
+            msync(file->data, file->size, MS_ASYNC);
+        }
+    }
+
+    static inline void closeMappedFile(mappedFile *file)
+    {
+        if(file->data)
+        {
+            msync(file->data, file->size, MS_SYNC);
+        }
+        unmapWholeFile(file);
+        if(file->descriptor >= 0)
+        {
+            close(file->descriptor);
+        }
+    }
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef PLATFORM_THREADS_H
+#define PLATFORM_THREADS_H
+
+#if defined(_WIN32)
+    #include <windows.h>
+    typedef SRWLOCK platformMutex;
+    #define PLATFORM_MUTEX_INITIALIZER SRWLOCK_INIT
+    #define lockMutex(mutex) AcquireSRWLockExclusive(mutex)
+    #define unlockMutex(mutex) ReleaseSRWLockExclusive(mutex)
+    #define initMutex(mutex) InitializeSRWLock(mutex)
+    #define destroyMutex(mutex)
+
+    typedef CONDITION_VARIABLE platformCondition;
+    #define initCondition(condition) InitializeConditionVariable(condition)
+    #define destroyCondition(condition)
+    #define waitCondition(condition, mutex) SleepConditionVariableSRW(condition, mutex, INFINITE, 0)
+    #define broadcastCondition(condition) WakeAllConditionVariable(condition)
+
+    typedef HANDLE platformThread;
+    #define THREAD_FUNCTION(name, argument) DWORD WINAPI name(LPVOID argument)
+    #define THREAD_RETURN return 0
+    #define startThread(thread, function, argument) (*(thread) = CreateThread(NULL, 0, function, argument, 0, NULL))
+    #define joinThread(thread) (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+
+    typedef INIT_ONCE platformOnce;
+    #define PLATFORM_ONCE_INITIALIZER INIT_ONCE_STATIC_INIT
+    static BOOL CALLBACK runOnceCallback(PINIT_ONCE once, PVOID function, PVOID *context)
+    {
+        ((void (*)())function)();
+        return TRUE;
+    }
+    #define runOnce(once, function) InitOnceExecuteOnce(once, runOnceCallback, (PVOID)(function), NULL)
+
+    typedef volatile LONG atomicCounter;
+    #define atomicFetchIncrement(counter) (InterlockedIncrement(counter) - 1)
+
+    static inline int getProcessorCount()
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return systemInfo.dwNumberOfProcessors;
+    }
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+    typedef pthread_mutex_t platformMutex;
+    #define PLATFORM_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+    #define lockMutex(mutex) pthread_mutex_lock(mutex)
+    #define unlockMutex(mutex) pthread_mutex_unlock(mutex)
+    #define initMutex(mutex) pthread_mutex_init(mutex, NULL)
+    #define destroyMutex(mutex) pthread_mutex_destroy(mutex)
+
+    typedef pthread_cond_t platformCondition;
+    #define initCondition(condition) pthread_cond_init(condition, NULL)
+    #define destroyCondition(condition) pthread_cond_destroy(condition)
+    #define waitCondition(condition, mutex) pthread_cond_wait(condition, mutex)
+    #define broadcastCondition(condition) pthread_cond_broadcast(condition)
+
+    typedef pthread_t platformThread;
+    #define THREAD_FUNCTION(name, argument) void *name(void *argument)
+    #define THREAD_RETURN return NULL
+    #define startThread(thread, function, argument) pthread_create(thread, NULL, function, argument)
+    #define joinThread(thread) pthread_join(thread, NULL)
+
+    typedef pthread_once_t platformOnce;
+    #define PLATFORM_ONCE_INITIALIZER PTHREAD_ONCE_INIT
+    #define runOnce(once, function) pthread_once(once, function)
+
+    typedef volatile long atomicCounter;
+    #define atomicFetchIncrement(counter) __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED)
+
+    static inline int getProcessorCount()
+    {
+        return sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef PLATFORM_TIME_H
+#define PLATFORM_TIME_H
+
+// Seconds of a monotonic clock with an arbitrary origin, for measuring durations
+#if defined(_WIN32)
+    #include <windows.h>
+    static inline double getMonotonicSeconds()
+    {
+        LARGE_INTEGER counter;
+        LARGE_INTEGER frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (double)counter.QuadPart / frequency.QuadPart;
+    }
+#else
+    #include <time.h>
+    static inline double getMonotonicSeconds()
+    {
+        struct timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return time.tv_sec + 1e-9 * time.tv_nsec;
+    }
+#endif
+
+#endif
\ No newline at end of file
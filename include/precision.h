@@ -0,0 +1,21 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <complex.h>
+#include <fftw3.h>
+
+// Floating point type of the image buffers and transforms, single precision if built with NAIS_SINGLE_PRECISION
+// Everything else, e.g. settings, atom locations and random sampling, stays in double precision
+#if defined(NAIS_SINGLE_PRECISION)
+    typedef float real;
+    typedef fftwf_complex fftComplex;
+    typedef fftwf_plan fftPlan;
+    #define FFTW(name) fftwf_##name
+#else
+    typedef double real;
+    typedef fftw_complex fftComplex;
+    typedef fftw_plan fftPlan;
+    #define FFTW(name) fftw_##name
+#endif
+
+#endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
 #include "platformDefines.h"
 
 typedef struct Settings
@@ -27,14 +30,18 @@ typedef struct Settings
     double exposureTime;
     double survivalProbability;
     double fillingRatio;
-    double lightSourceStdev;
+    double lightSourceStdev;    // In camera pixels, below one simulated pixel placed like point sources, above it accurate to about 1e-2 of the peak
+    double lightSourceCutoff;   // The padding of the optical convolution covers light source gaussians up to this many standard deviations, 8 if <= 0
+    int pixelIntegration;       // Integrate the optical image over the area of each simulated pixel instead of sampling it at the pixel centers
     int binning;
     int resolutionX;
     int resolutionY;
     double zernikeCoefficients[15];
 } settings;
 
-EXPORT void readConfig(const char *path);
+typedef struct SimContext SimContext;
+
+EXPORT int readConfig(const char *path);
 EXPORT void setStrayLightRate(double val);
 EXPORT void setDarkCurrentRate(double val);
 EXPORT void setDarkCurrentSamplingAlpha(double val);
@@ -60,8 +67,44 @@ EXPORT void setExposureTime(double val);
 EXPORT void setSurvivalProbability(double val);
 EXPORT void setFillingRatio(double val);
 EXPORT void setLightSourceStdev(double val);
+EXPORT void setLightSourceCutoff(double val);
+EXPORT void setPixelIntegration(int val);
 EXPORT void setBinning(int val);
 EXPORT void setResolution(int x, int y);
 EXPORT void setZernikeCoefficients(const double val[15]);
 
-extern settings simulationSettings;
\ No newline at end of file
+EXPORT int readConfigCtx(SimContext *context, const char *path);
+EXPORT void setStrayLightRateCtx(SimContext *context, double val);
+EXPORT void setDarkCurrentRateCtx(SimContext *context, double val);
+EXPORT void setDarkCurrentSamplingAlphaCtx(SimContext *context, double val);
+EXPORT void setDarkCurrentSamplingBetaCtx(SimContext *context, double val);
+EXPORT void setCicChanceCtx(SimContext *context, double val);
+EXPORT void setQuantumEfficiencyCtx(SimContext *context, double val);
+EXPORT void setWavelengthCtx(SimContext *context, double val);
+EXPORT void setNumericalApertureCtx(SimContext *context, double val);
+EXPORT void setPhysicalPixelSizeCtx(SimContext *context, double val);
+EXPORT void setMagnificationCtx(SimContext *context, double val);
+EXPORT void setBiasClampCtx(SimContext *context, double val);
+EXPORT void setBiasStdevCtx(SimContext *context, double val);
+EXPORT void setRowNoiseStdevCtx(SimContext *context, double val);
+EXPORT void setColumnNoiseScaleCtx(SimContext *context, double val);
+EXPORT void setFlickerNoiseScaleCtx(SimContext *context, double val);
+EXPORT void setPreampgainCtx(SimContext *context, double val);
+EXPORT void setSCICChanceCtx(SimContext *context, double val);
+EXPORT void setReadoutStdevCtx(SimContext *context, double val);
+EXPORT void setNumberGainRegistersCtx(SimContext *context, double val);
+EXPORT void setP0Ctx(SimContext *context, double val);
+EXPORT void setScatteringRateCtx(SimContext *context, double val);
+EXPORT void setExposureTimeCtx(SimContext *context, double val);
+EXPORT void setSurvivalProbabilityCtx(SimContext *context, double val);
+EXPORT void setFillingRatioCtx(SimContext *context, double val);
+EXPORT void setLightSourceStdevCtx(SimContext *context, double val);
+EXPORT void setLightSourceCutoffCtx(SimContext *context, double val);
+EXPORT void setPixelIntegrationCtx(SimContext *context, int val);
+EXPORT void setBinningCtx(SimContext *context, int val);
+EXPORT void setResolutionCtx(SimContext *context, int x, int y);
+EXPORT void setZernikeCoefficientsCtx(SimContext *context, const double val[15]);
+
+extern const settings defaultSettings;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef SIM_CONTEXT_H
+#define SIM_CONTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "platformDefines.h"
+#include "precision.h"
+#include "settings.h"
+#include "distributionSampling.h"
+#include "frameStats.h"
+
+typedef struct OpticalTransferFunctionCache
+{
+    _Bool valid;
+    int imageHeight;
+    int imageWidth;
+    double effectivePixelSize;
+    double numericalAperture;
+    double wavelength;
+    double zernikeCoefficients[15];
+    real *mtf;
+} otfCache;
+
+// Scratch memory that is kept across frames and only grows if a larger size is requested
+// Frames reserve all their buffers up front, so after the first frame of a size no allocations happen
+typedef struct WorkspaceBuffer
+{
+    void *data;
+    size_t capacity;
+} workspaceBuffer;
+
+// The 15 Zernike terms sampled on the pixels inside the pupil of a grid, so the phase for new coefficients is only their linear combination
+typedef struct ZernikeBasisCache
+{
+    _Bool valid;
+    int imageHeight;
+    int imageWidth;
+    int centerY;
+    int centerX;
+    double yFactor;
+    double xFactor;
+    double pupilRadius;
+    int pixelCount;
+    int pixelCapacity;      // The buffers only grow
+    int *pixelIndices;      // Position of each pupil pixel in the grid
+    double *terms;          // Term k of pupil pixel p at k * pixelCount + p
+    workspaceBuffer pupilValues;    // Cosines and sines of the phases of the pupil pixels
+} zernikeBasisCache;
+
+typedef struct Workspace
+{
+    workspaceBuffer image;
+    workspaceBuffer fftImage;
+    workspaceBuffer spectrum;
+    workspaceBuffer atomLocations;
+    workspaceBuffer siteIndices;
+    workspaceBuffer normalizedAtomLocations;
+    workspaceBuffer columnNoises;
+    workspaceBuffer readoutNoise;
+    workspaceBuffer lightSourceFactors;
+} workspace;
+
+// Everything needed to simulate images of one camera configuration
+// Different contexts can be used from different threads at the same time
+struct SimContext
+{
+    settings settings;
+    otfCache opticalTransferFunction;
+    // The mtf and the psf sample the pupil on different grids, so each keeps its own basis instead of evicting the other's
+    zernikeBasisCache mtfZernikeBasis;
+    zernikeBasisCache psfZernikeBasis;
+    workspace workspace;
+    uint64_t seed;
+    uint64_t frameIndex;    // Index of the next frame, selects its random streams
+    int threadCount;        // Threads used by the batch functions, 0 uses all processors
+    workspace *threadWorkspaces;
+    int threadWorkspaceCount;
+    frameStats lastFrameStats;      // Frames of the last image or batch call
+    frameStats cumulativeStats;
+};
+
+EXPORT SimContext *createSimContext();
+EXPORT void freeSimContext(SimContext *context);
+EXPORT SimContext *copySimContext(const SimContext *context);
+EXPORT SimContext *getDefaultSimContext();
+EXPORT void setSeedCtx(SimContext *context, uint64_t seed);
+EXPORT void setSeed(uint64_t seed);
+EXPORT void setFrameIndexCtx(SimContext *context, uint64_t frameIndex);
+EXPORT void setFrameIndex(uint64_t frameIndex);
+EXPORT uint64_t getFrameIndexCtx(const SimContext *context);
+EXPORT int usesSinglePrecision();
+EXPORT size_t getPeakMemoryCtx(const SimContext *context);
+EXPORT size_t getPeakMemory();
+EXPORT void setThreadCountCtx(SimContext *context, int threadCount);
+EXPORT void setThreadCount(int threadCount);
+EXPORT int usesFrameStats();
+EXPORT frameStats getLastFrameStatsCtx(const SimContext *context);
+EXPORT frameStats getLastFrameStats();
+EXPORT frameStats getCumulativeStatsCtx(const SimContext *context);
+EXPORT frameStats getCumulativeStats();
+EXPORT void resetCumulativeStatsCtx(SimContext *context);
+EXPORT void resetCumulativeStats();
+int getBatchThreadCount(const SimContext *context);
+workspace *reserveThreadWorkspaces(SimContext *context, int count);
+void *reserveWorkspaceBuffer(workspaceBuffer *buffer, size_t size);
+void *requireAllocation(void *data, size_t size);
+
+#endif
\ No newline at end of file
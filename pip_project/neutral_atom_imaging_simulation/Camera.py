@@ -11,6 +11,10 @@ class Camera(ABC):
     @abstractmethod
     def get_image_creation_method(self):
         pass
+
+    @abstractmethod
+    def get_layout_image_creation_method(self):
+        pass
     
     def set_zernike_coefficients(self, zernike_coefficients : typing.Union[np.ndarray, typing.Tuple[int,int,int,int,int,int,int,int,int,int,int,int,int,int,int]]):
         """Function for setting the zernike coefficients
@@ -33,11 +37,13 @@ class Camera(ABC):
         """
         self.zernike_coefficients = np.array(zernike_coefficients,np.float64)
 
-    def set_library(self, library : ctypes.CDLL):
+    def set_library(self, library : ctypes.CDLL, context : ctypes.c_void_p):
         """Function for setting the image generation library
         @param library The image generation C library
+        @param context The simulation context of the library that the settings are applied to
         @return None"""
         self.__library = library
+        self.__context = context
 
     @property
     def library(self):
@@ -45,12 +51,18 @@ class Camera(ABC):
         @return The image generation C library"""
         return self.__library
 
+    @property
+    def context(self):
+        """Function for getting the simulation context
+        @return The simulation context of the library"""
+        return self.__context
+
 class EMCCDCamera(Camera):
     """Use this camera if the generated images should look like they are taken by an electron multiplying charge-coupled device (EMCCD) camera"""
 
     def __init__(self, resolution : typing.Tuple[int,int], dark_current_rate : float = None, cic_chance : float = None, quantum_efficiency : float = None, numerical_aperture : float = None, 
         physical_pixel_size : float = None, magnification : float = None, bias_clamp : float = None, preampgain : float = None, scic_chance : float = None, readout_stdev : float = None, 
-        number_gain_reg : int = None, p0 : float = None, exposure_time : float = None, binning : int = 1):
+        number_gain_reg : int = None, p0 : float = None, exposure_time : float = None, binning : int = 1, pixel_integration : bool = None):
         """Constructor
         -----------
         Initializes all camera specific parameters and relays them to the library
@@ -72,7 +84,9 @@ class EMCCDCamera(Camera):
         (1 + p0)^number_gain_reg = gain\n
         [0.0,1.0]
         @param exposure_time Exposure time (s)
-        @param binning Binning factor for the final image"""
+        @param binning Binning factor for the final image
+        @param pixel_integration Integrate the light over the area of each pixel by its sinc response in the optical simulation instead of sampling it at the pixel centers,
+        which approximationSteps otherwise approximates by supersampling"""
         self.dark_current_rate = dark_current_rate
         self.cic_chance = cic_chance
         self.quantum_efficiency = quantum_efficiency
@@ -87,48 +101,72 @@ class EMCCDCamera(Camera):
         self.p0 = p0
         self.exposure_time = exposure_time
         self.binning = binning
+        self.pixel_integration = pixel_integration
         self.resolution = resolution
         self.zernike_coefficients = None
 
     def get_image_creation_method(self):
         """Function for acquiring the function handle of the library that is used to generate images using this camera
         @return The library function for generating images using this camera"""
-        return self.library.createImageEMCCD
+        return self.library.createImageEMCCDCtx
+
+    def get_layout_image_creation_method(self):
+        """Function for acquiring the function handle of the library that is used to generate images of a prepared atom layout using this camera
+        @return The library function for generating images of a prepared layout using this camera"""
+        return self.library.createImageEMCCDFromLayoutCtx
+
+    def get_batch_image_creation_method(self):
+        """Function for acquiring the function handle of the library that is used to generate batches of images using this camera
+        @return The library function for generating batches of images using this camera"""
+        return self.library.createImagesEMCCDBatchCtx
+
+    def get_frame_producer_creation_method(self, layout : bool = False):
+        """Function for acquiring the function handle of the library that is used to create a background frame producer using this camera
+        @param layout True for producers of prepared atom layouts
+        @return The library function for creating frame producers using this camera"""
+        return self.library.createFrameProducerEMCCDFromLayoutCtx if layout else self.library.createFrameProducerEMCCDCtx
+
+    def get_dataset_append_method(self):
+        """Function for acquiring the function handle of the library that is used to append images using this camera to a dataset file
+        @return The library function for appending images to a dataset using this camera"""
+        return self.library.appendDatasetEMCCDCtx
     
     def apply_settings(self):
         """Function for relaying any settings changes to the library
         @return None"""
         if self.dark_current_rate is not None:
-            self.library.setDarkCurrentRate(ctypes.c_double(self.dark_current_rate))
+            self.library.setDarkCurrentRateCtx(self.context, ctypes.c_double(self.dark_current_rate))
         if self.cic_chance is not None:
-            self.library.setCicChance(ctypes.c_double(self.cic_chance))
+            self.library.setCicChanceCtx(self.context, ctypes.c_double(self.cic_chance))
         if self.quantum_efficiency is not None:
-            self.library.setQuantumEfficiency(ctypes.c_double(self.quantum_efficiency))
+            self.library.setQuantumEfficiencyCtx(self.context, ctypes.c_double(self.quantum_efficiency))
         if self.numerical_aperture is not None:
-            self.library.setNumericalAperture(ctypes.c_double(self.numerical_aperture))
+            self.library.setNumericalApertureCtx(self.context, ctypes.c_double(self.numerical_aperture))
         if self.physical_pixel_size is not None:
-            self.library.setPhysicalPixelSize(ctypes.c_double(self.physical_pixel_size))
+            self.library.setPhysicalPixelSizeCtx(self.context, ctypes.c_double(self.physical_pixel_size))
         if self.magnification is not None:
-            self.library.setMagnification(ctypes.c_double(self.magnification))
+            self.library.setMagnificationCtx(self.context, ctypes.c_double(self.magnification))
         if self.bias_clamp is not None:
-            self.library.setBiasClamp(ctypes.c_double(self.bias_clamp))
+            self.library.setBiasClampCtx(self.context, ctypes.c_double(self.bias_clamp))
         if self.preampgain is not None:
-            self.library.setPreampgain(ctypes.c_double(self.preampgain))
+            self.library.setPreampgainCtx(self.context, ctypes.c_double(self.preampgain))
         if self.scic_chance is not None:
-            self.library.setSCICChance(ctypes.c_double(self.scic_chance))
+            self.library.setSCICChanceCtx(self.context, ctypes.c_double(self.scic_chance))
         if self.readout_stdev is not None:
-            self.library.setReadoutStdev(ctypes.c_double(self.readout_stdev))
+            self.library.setReadoutStdevCtx(self.context, ctypes.c_double(self.readout_stdev))
         if self.number_gain_reg is not None:
-            self.library.setNumberGainRegisters(ctypes.c_double(self.number_gain_reg))
+            self.library.setNumberGainRegistersCtx(self.context, ctypes.c_double(self.number_gain_reg))
         if self.p0 is not None:
-            self.library.setP0(ctypes.c_double(self.p0))
+            self.library.setP0Ctx(self.context, ctypes.c_double(self.p0))
         if self.exposure_time is not None:
-            self.library.setExposureTime(ctypes.c_double(self.exposure_time))
+            self.library.setExposureTimeCtx(self.context, ctypes.c_double(self.exposure_time))
         if self.binning is not None:
-            self.library.setBinning(ctypes.c_int(self.binning))
+            self.library.setBinningCtx(self.context, ctypes.c_int(self.binning))
+        if self.pixel_integration is not None:
+            self.library.setPixelIntegrationCtx(self.context, ctypes.c_int(int(self.pixel_integration)))
         if (self.zernike_coefficients is not None) and len(self.zernike_coefficients) >= 15:
-            self.library.setZernikeCoefficients(self.zernike_coefficients.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
-        self.library.setResolution(ctypes.c_int(self.resolution[0]), ctypes.c_int(self.resolution[1]))
+            self.library.setZernikeCoefficientsCtx(self.context, self.zernike_coefficients.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
+        self.library.setResolutionCtx(self.context, ctypes.c_int(self.resolution[0]), ctypes.c_int(self.resolution[1]))
 
 class CMOSCamera(Camera):
     """Use this camera if the generated images should look like they are taken by a CMOS camera"""
@@ -136,7 +174,7 @@ class CMOSCamera(Camera):
     def __init__(self, resolution : typing.Tuple[int,int], dark_current_sampling_alpha : float = None, dark_current_sampling_beta : float = None, 
         quantum_efficiency : float = None, numerical_aperture : float = None, physical_pixel_size : float = None, magnification : float = None, 
         bias_clamp : float = None, bias_stdev : float = None, row_noise_stdev : float = None, column_noise_scale : float = None, flicker_noise_scale : float = None, 
-        preampgain : float = None, readout_stdev : float = None, exposure_time : float = None, binning : int = 1):
+        preampgain : float = None, readout_stdev : float = None, exposure_time : float = None, binning : int = 1, pixel_integration : bool = None):
         """Constructor
         -----------
         Initializes all camera specific parameters and relays them to the library
@@ -156,7 +194,9 @@ class CMOSCamera(Camera):
         @param preampgain Preampgain of the camera
         @param readout_stdev Standard deviation of the final readout
         @param exposure_time Exposure time (s)
-        @param binning Binning factor for the final image"""
+        @param binning Binning factor for the final image
+        @param pixel_integration Integrate the light over the area of each pixel by its sinc response in the optical simulation instead of sampling it at the pixel centers,
+        which approximationSteps otherwise approximates by supersampling"""
         self.dark_current_sampling_alpha = dark_current_sampling_alpha
         self.dark_current_sampling_beta = dark_current_sampling_beta
         self.quantum_efficiency = quantum_efficiency
@@ -172,47 +212,71 @@ class CMOSCamera(Camera):
         self.readout_stdev = readout_stdev
         self.exposure_time = exposure_time
         self.binning = binning
+        self.pixel_integration = pixel_integration
         self.resolution = resolution
         self.zernike_coefficients = None
 
     def get_image_creation_method(self):
         """Function for acquiring the function handle of the library that is used to generate images using this camera
         @return The library function for generating images using this camera"""
-        return self.library.createImageCMOS
+        return self.library.createImageCMOSCtx
+
+    def get_layout_image_creation_method(self):
+        """Function for acquiring the function handle of the library that is used to generate images of a prepared atom layout using this camera
+        @return The library function for generating images of a prepared layout using this camera"""
+        return self.library.createImageCMOSFromLayoutCtx
+
+    def get_batch_image_creation_method(self):
+        """Function for acquiring the function handle of the library that is used to generate batches of images using this camera
+        @return The library function for generating batches of images using this camera"""
+        return self.library.createImagesCMOSBatchCtx
+
+    def get_frame_producer_creation_method(self, layout : bool = False):
+        """Function for acquiring the function handle of the library that is used to create a background frame producer using this camera
+        @param layout True for producers of prepared atom layouts
+        @return The library function for creating frame producers using this camera"""
+        return self.library.createFrameProducerCMOSFromLayoutCtx if layout else self.library.createFrameProducerCMOSCtx
+
+    def get_dataset_append_method(self):
+        """Function for acquiring the function handle of the library that is used to append images using this camera to a dataset file
+        @return The library function for appending images to a dataset using this camera"""
+        return self.library.appendDatasetCMOSCtx
     
     def apply_settings(self):
         """Function for relaying any settings changes to the library
         @return None"""
         if self.dark_current_sampling_alpha is not None:
-            self.library.setDarkCurrentSamplingAlpha(ctypes.c_double(self.dark_current_rate))
+            self.library.setDarkCurrentSamplingAlphaCtx(self.context, ctypes.c_double(self.dark_current_rate))
         if self.dark_current_sampling_beta is not None:
-            self.library.setDarkCurrentSamplingBeta(ctypes.c_double(self.dark_current_rate))
+            self.library.setDarkCurrentSamplingBetaCtx(self.context, ctypes.c_double(self.dark_current_rate))
         if self.quantum_efficiency is not None:
-            self.library.setQuantumEfficiency(ctypes.c_double(self.quantum_efficiency))
+            self.library.setQuantumEfficiencyCtx(self.context, ctypes.c_double(self.quantum_efficiency))
         if self.numerical_aperture is not None:
-            self.library.setNumericalAperture(ctypes.c_double(self.numerical_aperture))
+            self.library.setNumericalApertureCtx(self.context, ctypes.c_double(self.numerical_aperture))
         if self.physical_pixel_size is not None:
-            self.library.setPhysicalPixelSize(ctypes.c_double(self.physical_pixel_size))
+            self.library.setPhysicalPixelSizeCtx(self.context, ctypes.c_double(self.physical_pixel_size))
         if self.magnification is not None:
-            self.library.setMagnification(ctypes.c_double(self.magnification))
+            self.library.setMagnificationCtx(self.context, ctypes.c_double(self.magnification))
         if self.bias_clamp is not None:
-            self.library.setBiasClamp(ctypes.c_double(self.bias_clamp))
+            self.library.setBiasClampCtx(self.context, ctypes.c_double(self.bias_clamp))
         if self.bias_stdev is not None:
-            self.library.setBiasStdev(ctypes.c_double(self.bias_stdev))
+            self.library.setBiasStdevCtx(self.context, ctypes.c_double(self.bias_stdev))
         if self.row_noise_stdev is not None:
-            self.library.setRowNoiseStdev(ctypes.c_double(self.row_noise_stdev))
+            self.library.setRowNoiseStdevCtx(self.context, ctypes.c_double(self.row_noise_stdev))
         if self.column_noise_scale is not None:
-            self.library.setColumnNoiseScale(ctypes.c_double(self.column_noise_scale))
+            self.library.setColumnNoiseScaleCtx(self.context, ctypes.c_double(self.column_noise_scale))
         if self.flicker_noise_scale is not None:
-            self.library.setFlickerNoiseScale(ctypes.c_double(self.flicker_noise_scale))
+            self.library.setFlickerNoiseScaleCtx(self.context, ctypes.c_double(self.flicker_noise_scale))
         if self.preampgain is not None:
-            self.library.setPreampgain(ctypes.c_double(self.preampgain))
+            self.library.setPreampgainCtx(self.context, ctypes.c_double(self.preampgain))
         if self.readout_stdev is not None:
-            self.library.setReadoutStdev(ctypes.c_double(self.readout_stdev))
+            self.library.setReadoutStdevCtx(self.context, ctypes.c_double(self.readout_stdev))
         if self.exposure_time is not None:
-            self.library.setExposureTime(ctypes.c_double(self.exposure_time))
+            self.library.setExposureTimeCtx(self.context, ctypes.c_double(self.exposure_time))
         if self.binning is not None:
-            self.library.setBinning(ctypes.c_int(self.binning))
+            self.library.setBinningCtx(self.context, ctypes.c_int(self.binning))
+        if self.pixel_integration is not None:
+            self.library.setPixelIntegrationCtx(self.context, ctypes.c_int(int(self.pixel_integration)))
         if (self.zernike_coefficients is not None) and len(self.zernike_coefficients) >= 15:
-            self.library.setZernikeCoefficients(self.zernike_coefficients.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
-        self.library.setResolution(ctypes.c_int(self.resolution[0]), ctypes.c_int(self.resolution[1]))
\ No newline at end of file
+            self.library.setZernikeCoefficientsCtx(self.context, self.zernike_coefficients.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
+        self.library.setResolutionCtx(self.context, ctypes.c_int(self.resolution[0]), ctypes.c_int(self.resolution[1]))
\ No newline at end of file
@@ -18,35 +18,47 @@ class Experiment(ABC):
     def uses_camera_coords(self):
         pass
 
-    def set_library(self, library : ctypes.CDLL):
+    def set_library(self, library : ctypes.CDLL, context : ctypes.c_void_p):
         """Function for setting the image generation library
         @param library The image generation C library
+        @param context The simulation context of the library that the settings are applied to
         @return None"""
         self.__library = library
+        self.__context = context
 
     @property
     def library(self):
         """Function for getting the image generation library
         @return The image generation C library"""
         return self.__library
+
+    @property
+    def context(self):
+        """Function for getting the simulation context
+        @return The simulation context of the library"""
+        return self.__context
     
 class TweezerArray(Experiment):
     """Use this if a tweezer array is to be simulated"""
 
-    def __init__(self, stray_light_rate = None, imaging_wavelength = None, scattering_rate = None, survival_probability = None, fill_rate = None, light_source_stdev = None):
+    def __init__(self, stray_light_rate = None, imaging_wavelength = None, scattering_rate = None, survival_probability = None, fill_rate = None, light_source_stdev = None, light_source_cutoff = None):
         """Constructor
         @param stray_light_rate Rate of stray light (photons/s)
         @param imaging_wavelength The imaging wavelength (um)
         @param scattering_rate The average of photons emitted by an atom per second (photons/s)
         @param survival_probability The chance for an atom to survive being imaged\n
         [0.0,1.0]
-        @param fill_rate The chance for an atom site to be filled"""
+        @param fill_rate The chance for an atom site to be filled
+        @param light_source_stdev Standard deviation of the gaussian light source of each atom (pixels). Below 1 / approximation_steps pixels it is
+        as exact as point sources, above it the sub-pixel placement deviates by up to about 1% of the peak
+        @param light_source_cutoff Number of standard deviations of the light source the padding of the optical simulation covers, 8 if <= 0"""
         self.stray_light_rate = stray_light_rate
         self.imaging_wavelength = imaging_wavelength
         self.scattering_rate = scattering_rate
         self.survival_probability = survival_probability
         self.fill_rate = fill_rate
         self.light_source_stdev = light_source_stdev
+        self.light_source_cutoff = light_source_cutoff
         self.atom_sites = []
         self.__uses_camera_coords = True
     
@@ -54,17 +66,19 @@ class TweezerArray(Experiment):
         """Function for relaying any settings changes to the library
         @return None"""
         if self.stray_light_rate is not None:
-            self.library.setStrayLightRate(ctypes.c_double(self.stray_light_rate))
+            self.library.setStrayLightRateCtx(self.context, ctypes.c_double(self.stray_light_rate))
         if self.imaging_wavelength is not None:
-            self.library.setWavelength(ctypes.c_double(self.imaging_wavelength))
+            self.library.setWavelengthCtx(self.context, ctypes.c_double(self.imaging_wavelength))
         if self.scattering_rate is not None:
-            self.library.setScatteringRate(ctypes.c_double(self.scattering_rate))
+            self.library.setScatteringRateCtx(self.context, ctypes.c_double(self.scattering_rate))
         if self.survival_probability is not None:
-            self.library.setSurvivalProbability(ctypes.c_double(self.survival_probability))
+            self.library.setSurvivalProbabilityCtx(self.context, ctypes.c_double(self.survival_probability))
         if self.fill_rate is not None:
-            self.library.setFillingRatio(ctypes.c_double(self.fill_rate))
+            self.library.setFillingRatioCtx(self.context, ctypes.c_double(self.fill_rate))
         if self.light_source_stdev is not None:
-            self.library.setLightSourceStdev(ctypes.c_double(self.light_source_stdev))
+            self.library.setLightSourceStdevCtx(self.context, ctypes.c_double(self.light_source_stdev))
+        if self.light_source_cutoff is not None:
+            self.library.setLightSourceCutoffCtx(self.context, ctypes.c_double(self.light_source_cutoff))
 
     def set_atom_sites_camera_space(self, atom_sites):
         """Function for setting the list of atom sites in normalized camera coordinates.
@@ -9,19 +9,89 @@ import matplotlib.pyplot as plt
 from os import path
 import platform
 
+class FrameStats(ctypes.Structure):
+    """Mirror of the frameStats struct of the C library"""
+    _fields_ = [('frames', ctypes.c_uint64),
+                ('frame_seconds', ctypes.c_double),
+                ('light_source_seconds', ctypes.c_double),
+                ('optics_seconds', ctypes.c_double),
+                ('fft_seconds', ctypes.c_double),
+                ('photon_seconds', ctypes.c_double),
+                ('readout_seconds', ctypes.c_double),
+                ('poisson_draws', ctypes.c_uint64),
+                ('em_gain_samples', ctypes.c_uint64),
+                ('scic_events', ctypes.c_uint64)]
+
+    def to_dict(self):
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
 class ImageGenerator:
     """Main class for generating images"""
     __create_image_library = None
+    __context = None
     __camera = None
 
-    def __init__(self):
+    def __init__(self, seed = None):
         """Constructor
-        Loads C library for later use"""
+        Loads C library for later use
+        @param seed Seed for the random number generation, images are only reproducible if a seed is given"""
         if platform.system() == 'Windows':
             self.__create_image_library = ctypes.windll.LoadLibrary(path.dirname(__file__) + '/lib/createSampleImage.dll')
         else:
             self.__create_image_library = ctypes.cdll.LoadLibrary(path.dirname(__file__) + '/lib/libcreateSampleImage.so')
-        self.__create_image_library.readConfig.argtypes = [ctypes.c_char_p]
+        self.__create_image_library.createSimContext.restype = ctypes.c_void_p
+        self.__create_image_library.freeSimContext.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.readConfigCtx.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        self.__create_image_library.getPeakMemoryCtx.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.usesExactPointSourcesCtx.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+        self.__create_image_library.getPeakMemoryCtx.restype = ctypes.c_size_t
+        self.__create_image_library.getLastFrameStatsCtx.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.getLastFrameStatsCtx.restype = FrameStats
+        self.__create_image_library.getCumulativeStatsCtx.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.getCumulativeStatsCtx.restype = FrameStats
+        self.__create_image_library.resetCumulativeStatsCtx.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.setSeedCtx.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+        self.__create_image_library.setFrameIndexCtx.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+        self.__create_image_library.getFrameIndexCtx.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.getFrameIndexCtx.restype = ctypes.c_uint64
+        self.__create_image_library.exportWisdom.argtypes = [ctypes.c_char_p]
+        self.__create_image_library.importWisdom.argtypes = [ctypes.c_char_p]
+        self.__create_image_library.prepareAtomLayoutCtx.restype = ctypes.c_void_p
+        self.__create_image_library.freeAtomLayout.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.createImageEMCCDFromLayoutCtx.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int32), ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)]
+        self.__create_image_library.createImageCMOSFromLayoutCtx.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int32), ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)]
+        self.__create_image_library.createImagesEMCCDBatchCtx.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_ushort, ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint]
+        self.__create_image_library.createImagesCMOSBatchCtx.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_ushort, ctypes.c_void_p, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint]
+        for kind in ['EMCCD', 'CMOS']:
+            create_producer = getattr(self.__create_image_library, 'createFrameProducer' + kind + 'Ctx')
+            create_producer.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_ushort, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint, ctypes.c_int, ctypes.c_int]
+            create_producer.restype = ctypes.c_void_p
+            create_producer = getattr(self.__create_image_library, 'createFrameProducer' + kind + 'FromLayoutCtx')
+            create_producer.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint, ctypes.c_int, ctypes.c_int]
+            create_producer.restype = ctypes.c_void_p
+        self.__create_image_library.freeFrameProducer.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.acquireFrameBatch.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.POINTER(ctypes.c_double)), ctypes.POINTER(ctypes.c_uint64)]
+        self.__create_image_library.acquireFrameBatch.restype = ctypes.POINTER(ctypes.c_int32)
+        self.__create_image_library.releaseFrameBatch.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.openDataset.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_uint, ctypes.c_uint64]
+        self.__create_image_library.openDataset.restype = ctypes.c_void_p
+        self.__create_image_library.closeDataset.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.getDatasetFrameCount.argtypes = [ctypes.c_void_p]
+        self.__create_image_library.getDatasetFrameCount.restype = ctypes.c_uint64
+        self.__create_image_library.appendDatasetEMCCDCtx.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_ushort, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint64]
+        self.__create_image_library.appendDatasetCMOSCtx.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_ushort, ctypes.c_uint, ctypes.c_uint, ctypes.c_uint64]
+        # Each generator simulates with its own settings and caches
+        self.__context = ctypes.c_void_p(self.__create_image_library.createSimContext())
+        if not self.__context.value:
+            raise MemoryError("Could not create the simulation context")
+        if seed is not None:
+            self.set_seed(seed)
+
+    def __del__(self):
+        """Destructor
+        Frees the simulation context"""
+        if self.__context:
+            self.__create_image_library.freeSimContext(self.__context)
 
     def get_library(self):
         """Returns the loaded C library
@@ -33,7 +103,7 @@ class ImageGenerator:
         @param camera The camera to be used for imaging
         @return None"""
         self.__camera = camera
-        self.__camera.set_library(self.__create_image_library)
+        self.__camera.set_library(self.__create_image_library, self.__context)
         self.__camera.apply_settings()
     
     def set_experiment(self, experiment : Experiment):
@@ -41,31 +111,293 @@ class ImageGenerator:
         @param experiment The experiment to be imaged
         @return None"""
         self.__experiment = experiment
-        self.__experiment.set_library(self.__create_image_library)
+        self.__experiment.set_library(self.__create_image_library, self.__context)
         self.__experiment.apply_settings()
     
     def get_psf(self, resolution: int):
         psf = np.zeros((resolution * resolution,))
-        self.get_library().getConvolutedLightSource(psf.ctypes.data_as(ctypes.POINTER(ctypes.c_double)), resolution)
+        self.get_library().getConvolutedLightSourceCtx(self.__context, psf.ctypes.data_as(ctypes.POINTER(ctypes.c_double)), resolution)
         return psf.reshape((resolution,resolution))
 
+    def __get_site_array(self, sites = None):
+        """Returns the atom sites as contiguous (K, 2) float64 array that can be handed to the C library without copying
+        @param sites Sites to use instead of the ones of the experiment"""
+        if sites is None:
+            sites = self.__experiment.get_atom_sites()
+        return np.ascontiguousarray(np.asarray(sites, dtype=np.float64).reshape((-1, 2)))
+
+    def __get_binned_resolution(self):
+        return (self.__camera.resolution[0] // self.__camera.binning, self.__camera.resolution[1] // self.__camera.binning)
+
     def create_image(self, approximation_steps = 1):
         """Function to be called for generating an image
         @param approximation_steps The number of subdivisions for each pixel for the optical simulation
         @return Numpy array of generated image
         @return Numpy array of ground truths per atom site"""
-        resolution = (self.__camera.resolution[0] // self.__camera.binning, self.__camera.resolution[1] // self.__camera.binning)
+        resolution = self.__get_binned_resolution()
         image = np.zeros((resolution[0] * resolution[1],), np.int32)
-        atom_locations = self.__experiment.get_atom_sites()
-        atom_count = len(atom_locations)
-        c_atom_list = (ctypes.c_double * 2 * atom_count)()
+        sites = self.__get_site_array()
+        atom_count = len(sites)
         truth = np.zeros((atom_count), np.float64)
-        for j in range(atom_count):
-            c_atom_list[j][0] = atom_locations[j][0]
-            c_atom_list[j][1] = atom_locations[j][1]
-        self.__camera.get_image_creation_method()(image.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)), c_atom_list,\
+        self.__camera.get_image_creation_method()(self.__context, image.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)), ctypes.c_void_p(sites.ctypes.data),\
             ctypes.c_int(self.__experiment.uses_camera_coords()), truth.ctypes.data_as(ctypes.POINTER(ctypes.c_double)), atom_count, approximation_steps)
         return image.reshape((resolution[1],resolution[0])), truth
+
+    def create_images(self, n: int, out: np.ndarray = None, truth_out: np.ndarray = None, sites: np.ndarray = None, approximation_steps = 1):
+        """Function for generating n consecutive frames with a single call into the C library, which uses all threads set by set_thread_count.
+        The images are identical to n calls of create_image. The GIL is released while the images are generated
+        @param n Number of frames
+        @param out C-contiguous int32 array of shape (n, height, width) that is filled with the images, allocated if None
+        @param truth_out C-contiguous float64 array of shape (n, sites) that is filled with the ground truths, allocated if None
+        @param sites C-contiguous float64 array of shape (sites, 2) with the atom sites, the sites of the experiment if None
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation
+        @return Numpy array of generated images
+        @return Numpy array of ground truths per frame and atom site"""
+        resolution = self.__get_binned_resolution()
+        sites = self.__get_site_array(sites)
+        atom_count = len(sites)
+        if out is None:
+            out = np.empty((n, resolution[1], resolution[0]), np.int32)
+        if truth_out is None:
+            truth_out = np.empty((n, atom_count), np.float64)
+        if out.shape != (n, resolution[1], resolution[0]) or out.dtype != np.int32 or not out.flags['C_CONTIGUOUS'] or not out.flags['WRITEABLE']:
+            raise ValueError('out has to be a writeable C-contiguous int32 array of shape ' + str((n, resolution[1], resolution[0])))
+        if truth_out.shape != (n, atom_count) or truth_out.dtype != np.float64 or not truth_out.flags['C_CONTIGUOUS'] or not truth_out.flags['WRITEABLE']:
+            raise ValueError('truth_out has to be a writeable C-contiguous float64 array of shape ' + str((n, atom_count)))
+        # ctypes releases the GIL for calls into libraries loaded with CDLL or WinDLL
+        self.__camera.get_batch_image_creation_method()(self.__context, out.ctypes.data, sites.ctypes.data,\
+            self.__experiment.uses_camera_coords(), truth_out.ctypes.data, atom_count, approximation_steps, n)
+        return out, truth_out
     
+    def prepare_layout(self, approximation_steps = 1):
+        """Function for precomputing the expected photon footprint of every atom site of the current experiment.
+        Use this if the atom sites stay the same for many images, since images of a prepared layout skip the optical simulation.
+        The footprints are recomputed automatically if optical settings change
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation
+        @return Layout to be passed to create_image_from_layout"""
+        sites = self.__get_site_array()
+        atom_count = len(sites)
+        handle = self.__create_image_library.prepareAtomLayoutCtx(self.__context, ctypes.c_void_p(sites.ctypes.data), ctypes.c_int(self.__experiment.uses_camera_coords()), atom_count, approximation_steps)
+        if not handle:
+            raise ValueError('approximation_steps has to be positive and the layout has to fit into memory')
+        return AtomLayout(self.__create_image_library, handle, atom_count)
+
+    def create_image_from_layout(self, layout):
+        """Function to be called for generating an image of a prepared layout
+        @param layout Layout returned by prepare_layout
+        @return Numpy array of generated image
+        @return Numpy array of ground truths per atom site"""
+        resolution = self.__get_binned_resolution()
+        image = np.zeros((resolution[0] * resolution[1],), np.int32)
+        truth = np.zeros((layout.site_count), np.float64)
+        self.__camera.get_layout_image_creation_method()(self.__context, image.ctypes.data_as(ctypes.POINTER(ctypes.c_int32)), layout.handle,\
+            truth.ctypes.data_as(ctypes.POINTER(ctypes.c_double)))
+        return image.reshape((resolution[1],resolution[0])), truth
+
+    def create_frame_producer(self, batch_size: int, depth: int = 4, thread_count: int = 0, approximation_steps = 1, layout = None):
+        """Function for creating an iterator over batches of frames that are generated by native threads in the background, ahead of their use.
+        The frames continue from the current frame index and settings. The producer keeps its own copies of these and of the layout,
+        so later changes to the generator or the layout do not affect it
+        @param batch_size Number of frames per batch
+        @param depth Number of batches that are generated ahead
+        @param thread_count Number of threads generating the frames, 0 uses all processors
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation
+        @param layout Layout returned by prepare_layout to use instead of the sites of the experiment
+        @return FrameProducer yielding tuples of images and truths"""
+        resolution = self.__get_binned_resolution()
+        if layout is not None:
+            handle = self.__camera.get_frame_producer_creation_method(True)(self.__context, layout.handle, batch_size, depth, thread_count)
+            site_count = layout.site_count
+        else:
+            sites = self.__get_site_array()
+            site_count = len(sites)
+            handle = self.__camera.get_frame_producer_creation_method()(self.__context, sites.ctypes.data,\
+                self.__experiment.uses_camera_coords(), site_count, approximation_steps, batch_size, depth, thread_count)
+        if not handle:
+            raise ValueError('batch_size and depth have to be positive and the producer has to fit into memory')
+        return FrameProducer(self.__create_image_library, handle, (batch_size, resolution[1], resolution[0]), (batch_size, site_count))
+
+    def write_dataset(self, image_path: str, frame_count: int, truth_path: str = None, approximation_steps = 1, first_frame_index = 0):
+        """Function for generating a dataset straight into .npy files, without passing the images through python.
+        Frame k of the file is frame first_frame_index + k of the current seed, so interrupted runs are resumed by calling this again with the same arguments.
+        The files can be read with numpy.load(path, mmap_mode='r')
+        @param image_path .npy file for the images, of shape (frames, height, width) and type int32
+        @param frame_count Number of frames the dataset should hold, frames already in the file are kept
+        @param truth_path .npy file for the ground truths per atom site, of shape (frames, sites) and type float64, None to not store them
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation
+        @param first_frame_index Frame index of the first frame in the file
+        @return True if the dataset was written successfully"""
+        resolution = self.__get_binned_resolution()
+        sites = self.__get_site_array()
+        atom_count = len(sites)
+        dataset = self.__create_image_library.openDataset(image_path.encode('utf-8'), truth_path.encode('utf-8') if truth_path else None,\
+            resolution[1], resolution[0], atom_count, frame_count)
+        if not dataset:
+            return False
+        written = self.__create_image_library.getDatasetFrameCount(dataset)
+        success = True
+        if written < frame_count:
+            self.set_frame_index(first_frame_index + written)
+            success = bool(self.__camera.get_dataset_append_method()(self.__context, dataset, sites.ctypes.data,\
+                self.__experiment.uses_camera_coords(), atom_count, approximation_steps, frame_count - written))
+        self.__create_image_library.closeDataset(dataset)
+        return success
+
+    def set_seed(self, seed: int):
+        """Function for seeding the random number generation. Restarts the frame sequence, so the following images are reproducible
+        @param seed Seed, 64 bit unsigned integer
+        @return None"""
+        self.__create_image_library.setSeedCtx(self.__context, seed)
+
+    def set_frame_index(self, frame_index: int):
+        """Function for jumping to a frame of the current seed. Each frame only depends on the seed and its index,
+        so e.g. different processes can generate disjoint frame ranges of the same data set
+        @param frame_index Index of the next generated frame
+        @return None"""
+        self.__create_image_library.setFrameIndexCtx(self.__context, frame_index)
+
+    def get_frame_index(self):
+        """Returns the index of the next generated frame
+        @return Frame index"""
+        return self.__create_image_library.getFrameIndexCtx(self.__context)
+
+    def reserve_workspace(self, approximation_steps = 1):
+        """Function for allocating all memory needed to generate images of the current camera and experiment up front.
+        Otherwise it is allocated while generating the first images
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation, 0 if only prepared layouts are used
+        @return Number of bytes held by the simulation"""
+        self.__create_image_library.reserveWorkspaceCtx(self.__context, len(self.__experiment.get_atom_sites()), approximation_steps)
+        return self.get_peak_memory()
+
+    def get_peak_memory(self):
+        """Returns the memory held by the simulation for buffers and caches, which only grows, so it is also the peak memory
+        @return Number of bytes"""
+        return self.__create_image_library.getPeakMemoryCtx(self.__context)
+
+    def set_thread_count(self, thread_count: int):
+        """Function for setting the number of threads used for generating batches of images
+        @param thread_count Number of threads, 0 uses all processors
+        @return None"""
+        self.__create_image_library.setThreadCountCtx(self.__context, ctypes.c_int(thread_count))
+
+    def uses_single_precision(self):
+        """Returns whether the loaded C library was built with single precision images and transforms
+        @return True for a single precision build"""
+        return bool(self.__create_image_library.usesSinglePrecision())
+
+    def uses_exact_point_sources(self, approximation_steps: int = 1):
+        """Returns whether atoms without a light source stdev are placed exactly at their sub-pixel positions with the current optics.
+        This holds while 2 * numerical aperture * pixel size / (wavelength * approximation_steps) stays below about 0.35, otherwise they are rounded to the nearest pixel
+        @param approximation_steps The number of subdivisions for each pixel for the optical simulation
+        @return True if the positions are exact"""
+        return bool(self.__create_image_library.usesExactPointSourcesCtx(self.__context, ctypes.c_uint(approximation_steps)))
+
+    def uses_frame_stats(self):
+        """Returns whether the loaded C library was built with STATS=1 and records frame statistics
+        @return True if statistics are recorded"""
+        return bool(self.__create_image_library.usesFrameStats())
+
+    def get_last_frame_stats(self):
+        """Returns the wall time per stage and the number of random draws of the frames of the last image or batch call.
+        Times of batches are summed over their threads. All values are zero unless the library was built with STATS=1
+        @return Dictionary of frames, frame_seconds, light_source_seconds, optics_seconds, fft_seconds, photon_seconds, readout_seconds, poisson_draws, em_gain_samples and scic_events"""
+        return self.__create_image_library.getLastFrameStatsCtx(self.__context).to_dict()
+
+    def get_cumulative_stats(self):
+        """Returns the statistics of get_last_frame_stats summed over all calls since the generator was created or reset_cumulative_stats
+        @return Dictionary of the same keys as get_last_frame_stats"""
+        return self.__create_image_library.getCumulativeStatsCtx(self.__context).to_dict()
+
+    def reset_cumulative_stats(self):
+        """Sets all cumulative statistics back to zero
+        @return None"""
+        self.__create_image_library.resetCumulativeStatsCtx(self.__context)
+
     def read_config_file(self, path: str):
-        self.__create_image_library.readConfig(path.encode('utf-8'))
+        """Function for reading the settings from a file
+        @param path The settings file
+        @return False if the file could not be opened, the settings are unchanged then"""
+        return bool(self.__create_image_library.readConfigCtx(self.__context, path.encode('utf-8')))
+
+    def set_fft_planning_rigor(self, level: int):
+        """Function for setting how thoroughly FFTW searches for fast transforms. Transforms planned afterwards use the new level, plans created before are kept for frames still using them
+        @param level 0: FFTW_ESTIMATE, 1: FFTW_MEASURE (default), 2: FFTW_PATIENT, 3: FFTW_EXHAUSTIVE
+        @return None"""
+        self.__create_image_library.setFFTPlanningRigor(ctypes.c_int(level))
+
+    def export_wisdom(self, path: str):
+        """Function for saving the FFTW wisdom gathered while planning transforms
+        @param path File the wisdom is written to
+        @return True if the wisdom was written successfully"""
+        return bool(self.__create_image_library.exportWisdom(path.encode('utf-8')))
+
+    def import_wisdom(self, path: str):
+        """Function for loading previously exported FFTW wisdom so that transforms do not have to be planned again
+        @param path File the wisdom is read from
+        @return True if the wisdom was read successfully"""
+        return bool(self.__create_image_library.importWisdom(path.encode('utf-8')))
+
+
+class AtomLayout:
+    """Atom sites with precomputed footprints, created by ImageGenerator.prepare_layout"""
+
+    def __init__(self, library, handle, site_count : int):
+        self.__library = library
+        self.handle = ctypes.c_void_p(handle)
+        self.site_count = site_count
+
+    def __del__(self):
+        self.__library.freeAtomLayout(self.handle)
+
+
+class FrameProducer:
+    """Iterator over batches of frames generated in the background, created by ImageGenerator.create_frame_producer.
+    Each batch is a tuple of an int32 array of shape (batch size, height, width) and a float64 array of shape (batch size, sites).
+    These are views of the producer's buffers and stay valid until the next batch is requested, so copy them to keep them longer"""
+
+    def __init__(self, library, handle, image_shape, truth_shape):
+        self.__library = library
+        self.__handle = ctypes.c_void_p(handle)
+        self.__image_shape = image_shape
+        self.__truth_shape = truth_shape
+        self.__holds_batch = False
+        self.first_frame_index = None
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        if not self.__handle:
+            raise StopIteration
+        self.__release()
+        truths = ctypes.POINTER(ctypes.c_double)()
+        first_frame_index = ctypes.c_uint64()
+        # Blocks without holding the GIL until the batch is ready
+        images = self.__library.acquireFrameBatch(self.__handle, ctypes.byref(truths), ctypes.byref(first_frame_index))
+        self.__holds_batch = True
+        self.first_frame_index = first_frame_index.value
+        image_array = np.ctypeslib.as_array(images, shape=self.__image_shape)
+        truth_array = np.ctypeslib.as_array(truths, shape=self.__truth_shape) if truths else np.zeros(self.__truth_shape, np.float64)
+        return image_array, truth_array
+
+    def __release(self):
+        if self.__holds_batch:
+            self.__library.releaseFrameBatch(self.__handle)
+            self.__holds_batch = False
+
+    def close(self):
+        """Stops the background threads and frees the buffers, arrays of the last batch become invalid
+        @return None"""
+        if self.__handle:
+            self.__release()
+            self.__library.freeFrameProducer(self.__handle)
+            self.__handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def __del__(self):
+        self.close()
\ No newline at end of file
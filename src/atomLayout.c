@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+#include "simContext.h"
+#include "imageModulation.h"
+#include "createSampleImage.h"
+
+// Fraction of a site's photons on the camera that its cropped footprint has to cover, the footprint is scaled up by the rest
+#define FOOTPRINT_ENCLOSED_FRACTION 0.99
+
+static _Bool isAtomLayoutUpToDate(const SimContext *context, const atomLayout *layout)
+{
+    return layout->resolutionX == context->settings.resolutionX && 
+        layout->resolutionY == context->settings.resolutionY && 
+        layout->pixelSize == context->settings.pixelSize && 
+        layout->numericalAperture == context->settings.numericalAperture && 
+        layout->wavelength == context->settings.wavelength && 
+        layout->lightSourceStdev == context->settings.lightSourceStdev && 
+        layout->lightSourceCutoff == context->settings.lightSourceCutoff && 
+        layout->pixelIntegration == context->settings.pixelIntegration && 
+        !memcmp(layout->zernikeCoefficients, context->settings.zernikeCoefficients, 15 * sizeof(double));
+}
+
+static void computeSiteFootprint(SimContext *context, siteFootprint *footprint, real *image, real *cameraImage, const double site[2], int approximationSteps)
+{
+    int imageHeight = approximationSteps * context->settings.resolutionY;
+    int imageWidth = approximationSteps * context->settings.resolutionX;
+
+    footprint->width = 0;
+    footprint->height = 0;
+    footprint->values = NULL;
+
+    double x = imageWidth * site[0];
+    double y = imageHeight * site[1];
+    if(x < 0 || y < 0 || x >= imageWidth || y >= imageHeight)
+    {
+        return;
+    }
+    // Pixel k covers [k, k + 1), while addLightSource places points relative to the pixel centers
+    opticsGrid grid = getOpticsGrid(context, approximationSteps);
+    y += grid.offsetY - 0.5;
+    x += grid.offsetX - 0.5;
+
+    // Same zero-padded optical simulation as for whole frames, but with a single atom of brightness one
+    memset(image, 0, grid.height * grid.width * sizeof(real));
+    double pointSpread = getPointSourceSpread(context, context->settings.pixelSize / approximationSteps);
+    addLightSource(image, grid.height, grid.width, x, y, 1, context->settings.lightSourceStdev * approximationSteps, pointSpread);
+    simulateOptics(context, image, grid.height, grid.width, context->settings.pixelSize / approximationSteps, context->settings.lightSourceStdev * approximationSteps, 1);
+
+    // Binning approximation steps
+    double totalPhotons = 0;
+    double maxValue = 0;
+    int peakX = 0;
+    int peakY = 0;
+    for (int i = 0; i < context->settings.resolutionY; i++)
+    {
+        for(int j = 0; j < context->settings.resolutionX; j++)
+        {
+            double photons = 0;
+            for(int yi = 0; yi < approximationSteps; yi++)
+            {
+                for(int xi = 0; xi < approximationSteps; xi++)
+                {
+                    photons += image[(grid.offsetY + i * approximationSteps + yi) * grid.width + grid.offsetX + j * approximationSteps + xi];
+                }
+            }
+            cameraImage[i * context->settings.resolutionX + j] = photons;
+            totalPhotons += photons;
+            if(photons > maxValue)
+            {
+                maxValue = photons;
+                peakX = j;
+                peakY = i;
+            }
+        }
+    }
+    if(maxValue <= 0)
+    {
+        return;
+    }
+
+    // Grow a square around the peak until it holds the required fraction of all photons reaching the camera
+    int minX = peakX;
+    int maxX = peakX;
+    int minY = peakY;
+    int maxY = peakY;
+    double enclosedPhotons = maxValue;
+    while(enclosedPhotons < FOOTPRINT_ENCLOSED_FRACTION * totalPhotons && 
+        (minX > 0 || minY > 0 || maxX < context->settings.resolutionX - 1 || maxY < context->settings.resolutionY - 1))
+    {
+        int newMinX = minX > 0 ? minX - 1 : 0;
+        int newMinY = minY > 0 ? minY - 1 : 0;
+        int newMaxX = maxX < context->settings.resolutionX - 1 ? maxX + 1 : maxX;
+        int newMaxY = maxY < context->settings.resolutionY - 1 ? maxY + 1 : maxY;
+        for (int i = newMinY; i <= newMaxY; i++)
+        {
+            for(int j = newMinX; j <= newMaxX; j++)
+            {
+                if(i < minY || i > maxY || j < minX || j > maxX)
+                {
+                    enclosedPhotons += cameraImage[i * context->settings.resolutionX + j];
+                }
+            }
+        }
+        minX = newMinX;
+        minY = newMinY;
+        maxX = newMaxX;
+        maxY = newMaxY;
+    }
+
+    int width = maxX - minX + 1;
+    int height = maxY - minY + 1;
+    footprint->values = malloc(width * height * sizeof(real));
+    if(!footprint->values)
+    {
+        return;
+    }
+    footprint->x = minX;
+    footprint->y = minY;
+    footprint->width = width;
+    footprint->height = height;
+
+    // The photons cropped from the far tails are added back proportionally, so each atom brings as many photons as in a whole frame
+    double scale = totalPhotons / enclosedPhotons;
+    for (int i = 0; i < height; i++)
+    {
+        for(int j = 0; j < width; j++)
+        {
+            footprint->values[i * width + j] = cameraImage[(minY + i) * context->settings.resolutionX + minX + j] * scale;
+        }
+    }
+}
+
+void updateAtomLayout(SimContext *context, atomLayout *layout)
+{
+    if(isAtomLayoutUpToDate(context, layout))
+    {
+        return;
+    }
+
+    opticsGrid grid = getOpticsGrid(context, layout->approximationSteps);
+
+    // The layout is also updated while creating images, which cannot report a failure, so these abort like the workspaces
+    double (*normalizedAtomLocations)[2] = requireAllocation(malloc(layout->siteCount * 2 * sizeof(double)), layout->siteCount * 2 * sizeof(double));
+    normalizeCameraCoords(context, normalizedAtomLocations, layout->sites, layout->siteCount, layout->cameraCoords);
+
+    real *image = requireAllocation(malloc(grid.height * grid.width * sizeof(real)), grid.height * grid.width * sizeof(real));
+    real *cameraImage = requireAllocation(malloc(context->settings.resolutionY * context->settings.resolutionX * sizeof(real)),
+        context->settings.resolutionY * context->settings.resolutionX * sizeof(real));
+    for(unsigned int s = 0; s < layout->siteCount; s++)
+    {
+        free(layout->footprints[s].values);
+        computeSiteFootprint(context, &layout->footprints[s], image, cameraImage, normalizedAtomLocations[s], layout->approximationSteps);
+    }
+
+    layout->resolutionX = context->settings.resolutionX;
+    layout->resolutionY = context->settings.resolutionY;
+    layout->pixelSize = context->settings.pixelSize;
+    layout->numericalAperture = context->settings.numericalAperture;
+    layout->wavelength = context->settings.wavelength;
+    layout->lightSourceStdev = context->settings.lightSourceStdev;
+    layout->lightSourceCutoff = context->settings.lightSourceCutoff;
+    layout->pixelIntegration = context->settings.pixelIntegration;
+    memcpy(layout->zernikeCoefficients, context->settings.zernikeCoefficients, 15 * sizeof(double));
+
+    free(image);
+    free(cameraImage);
+    free(normalizedAtomLocations);
+}
+
+// Returns NULL if approximationSteps is zero or the layout does not fit into memory
+atomLayout *prepareAtomLayoutCtx(SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    if(approximationSteps < 1)
+    {
+        return NULL;
+    }
+    atomLayout *layout = calloc(1, sizeof(atomLayout));
+    if(!layout)
+    {
+        return NULL;
+    }
+    layout->sites = malloc(potentialAtomCount * 2 * sizeof(double));
+    layout->footprints = calloc(potentialAtomCount, sizeof(siteFootprint));
+    if(potentialAtomCount && (!layout->sites || !layout->footprints))
+    {
+        freeAtomLayout(layout);
+        return NULL;
+    }
+    memcpy(layout->sites, potentialAtomLocations, potentialAtomCount * 2 * sizeof(double));
+    layout->siteCount = potentialAtomCount;
+    layout->cameraCoords = cameraCoords;
+    layout->approximationSteps = approximationSteps;
+
+    updateAtomLayout(context, layout);
+    return layout;
+}
+
+atomLayout *prepareAtomLayout(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    return prepareAtomLayoutCtx(getDefaultSimContext(), potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps);
+}
+
+// Independent copy with its own footprints, updating either of them leaves the other one untouched
+atomLayout *copyAtomLayout(const atomLayout *layout)
+{
+    atomLayout *copy = malloc(sizeof(atomLayout));
+    if(!copy)
+    {
+        return NULL;
+    }
+    *copy = *layout;
+    copy->sites = malloc(layout->siteCount * 2 * sizeof(double));
+    copy->footprints = calloc(layout->siteCount, sizeof(siteFootprint));
+    if(!copy->sites || !copy->footprints)
+    {
+        copy->siteCount = 0;
+        freeAtomLayout(copy);
+        return NULL;
+    }
+    memcpy(copy->sites, layout->sites, layout->siteCount * 2 * sizeof(double));
+    for(unsigned int s = 0; s < layout->siteCount; s++)
+    {
+        const siteFootprint *footprint = &layout->footprints[s];
+        copy->footprints[s] = *footprint;
+        copy->footprints[s].values = NULL;
+        if(footprint->values)
+        {
+            size_t size = footprint->width * footprint->height * sizeof(real);
+            copy->footprints[s].values = malloc(size);
+            if(!copy->footprints[s].values)
+            {
+                freeAtomLayout(copy);
+                return NULL;
+            }
+            memcpy(copy->footprints[s].values, footprint->values, size);
+        }
+    }
+    return copy;
+}
+
+void freeAtomLayout(atomLayout *layout)
+{
+    if(!layout)
+    {
+        return;
+    }
+    for(unsigned int s = 0; s < layout->siteCount; s++)
+    {
+        free(layout->footprints[s].values);
+    }
+    free(layout->footprints);
+    free(layout->sites);
+    free(layout);
+}
\ No newline at end of file
@@ -0,0 +1,477 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "settings.h"
+#include "simContext.h"
+#include "imageModulation.h"
+#include "createSampleImage.h"
+#include "platformTime.h"
+
+#ifndef NAIS_VERSION
+    #define NAIS_VERSION "unknown"
+#endif
+
+#define MIN_FRAMES 3
+
+// The pixel integration validation compares expected images of these sizes against supersampling with the most approximation steps
+#define VALIDATION_RESOLUTION 256
+#define VALIDATION_ATOMS 100
+#define VALIDATION_REFERENCE_STEPS 8
+#define VALIDATION_QUICK_REFERENCE_STEPS 4
+
+/*
+ * Times the stages of single frames on one thread and writes the mean seconds per frame as JSON
+ * frame, optics, photons (EMCCD) and readout are the library's own passes, readout combining binning, EM gain, sCIC and readout noise for EMCCD
+ * and all sampling for CMOS. binning, emGain, sCIC, readoutNoise and photons (CMOS) are kernels of these combined passes,
+ * timed separately on the data of the same frame, so they overlap with readout
+ */
+typedef enum Stage
+{
+    STAGE_FRAME,
+    STAGE_OPTICS,
+    STAGE_PHOTONS,
+    STAGE_READOUT,
+    STAGE_BINNING,
+    STAGE_EM_GAIN,
+    STAGE_SCIC,
+    STAGE_READOUT_NOISE,
+    STAGE_COUNT
+} stage;
+
+static const char *stageNames[STAGE_COUNT] = {"frame", "optics", "photons", "readout", "binning", "emGain", "sCIC", "readoutNoise"};
+
+typedef struct BenchmarkCase
+{
+    _Bool emccd;
+    int resolution;
+    int approximationSteps;
+    int binning;
+    int atomCount;
+} benchmarkCase;
+
+typedef struct BenchmarkBuffers
+{
+    double (*sites)[2];
+    int *binnedImage;
+    int *binnedCounts;
+    randomStream *gainStreams;  // State of the stream of each binned pixel after its EM gain draw, where readoutEMCCD continues with the sCIC events
+    double *readoutNoise;
+} benchmarkBuffers;
+
+// Sites on a square grid over the central 80% of the field of view
+static void placeSites(double sites[][2], int atomCount)
+{
+    int side = ceil(sqrt(atomCount));
+    for(int a = 0; a < atomCount; a++)
+    {
+        sites[a][0] = 0.1 + 0.8 * (a % side + 0.5) / side;
+        sites[a][1] = 0.1 + 0.8 * (a / side + 0.5) / side;
+    }
+}
+
+static void binCounts(const SimContext *context, int *binnedCounts, const real *image, int rowStride, int approximationSteps)
+{
+    int size = context->settings.binning * approximationSteps;
+    int binnedWidth = context->settings.resolutionX / context->settings.binning;
+    int binnedHeight = context->settings.resolutionY / context->settings.binning;
+    for(int i = 0; i < binnedHeight; i++)
+    {
+        for(int j = 0; j < binnedWidth; j++)
+        {
+            double electrons = 0;
+            for(int y = 0; y < size; y++)
+            {
+                for(int x = 0; x < size; x++)
+                {
+                    electrons += image[(i * size + y) * rowStride + j * size + x];
+                }
+            }
+            binnedCounts[i * binnedWidth + j] = electrons;
+        }
+    }
+}
+
+static void sampleEMGains(const SimContext *context, uint64_t frameIndex, int *binnedCounts, randomStream *gainStreams)
+{
+    double gamma = pow(1 + context->settings.p0, context->settings.numberGainRegisters);
+    int binnedSize = (context->settings.resolutionX / context->settings.binning) * (context->settings.resolutionY / context->settings.binning);
+    for(int p = 0; p < binnedSize; p++)
+    {
+        initRandomStream(&gainStreams[p], context->seed, frameIndex, RANDOM_DOMAIN_GAIN, p);
+        binnedCounts[p] = sampleEMGain(&gainStreams[p], binnedCounts[p], gamma);
+    }
+}
+
+// Continues the stream of each binned pixel after its EM gain draw, as readoutEMCCD does
+static void sampleSCICs(SimContext *context, int *binnedCounts, randomStream *gainStreams)
+{
+    int binnedSize = (context->settings.resolutionX / context->settings.binning) * (context->settings.resolutionY / context->settings.binning);
+    for(int p = 0; p < binnedSize; p++)
+    {
+        binnedCounts[p] += sampleSCICElectrons(context, &gainStreams[p]);
+    }
+}
+
+// The random fills of the readout pass, per binned row for EMCCD and per camera row for CMOS
+static void sampleReadoutNoise(const SimContext *context, uint64_t frameIndex, double *readoutNoise, _Bool emccd)
+{
+    int width = context->settings.resolutionX;
+    int binnedWidth = width / context->settings.binning;
+    int rows = emccd ? context->settings.resolutionY / context->settings.binning : context->settings.resolutionY;
+    for(int i = 0; i < rows; i++)
+    {
+        randomStream random;
+        initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_READOUT, i);
+        if(emccd)
+        {
+            fillGaussian(&random, readoutNoise, binnedWidth, context->settings.biasClamp, context->settings.readoutStdev);
+        }
+        else
+        {
+            fillGaussian(&random, readoutNoise, width, context->settings.biasClamp, context->settings.biasStdev);
+            fillGumbel(&random, readoutNoise + width, width, 0, context->settings.flickerNoiseScale);
+            fillGaussian(&random, readoutNoise + 2 * width, width, 0, context->settings.readoutStdev);
+        }
+    }
+}
+
+// Dark current and Poisson draws of the CMOS pass for each camera pixel
+static void samplePhotonsCMOS(const SimContext *context, uint64_t frameIndex, const real *image, int rowStride, int approximationSteps, int *binnedCounts)
+{
+    int width = context->settings.resolutionX;
+    int binning = context->settings.binning;
+    int subPixels = approximationSteps * approximationSteps;
+    int binnedWidth = width / binning;
+    double darkCurrentShape = context->settings.darkCurrentSamplingAlpha * subPixels;
+    for(int i = 0; i < context->settings.resolutionY / binning * binning; i++)
+    {
+        for(int j = 0; j < binnedWidth * binning; j++)
+        {
+            randomStream random;
+            initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_PHOTONS, i * width + j);
+            double darkCurrent = sampleGamma(&random, darkCurrentShape, context->settings.darkCurrentSamplingBeta) / subPixels;
+            double light = image[i * approximationSteps * rowStride + j * approximationSteps];
+            binnedCounts[(i / binning) * binnedWidth + j / binning] += samplePoisson(&random, light + darkCurrent * context->settings.exposureTime);
+        }
+    }
+}
+
+// Adds the time since start to the stage and restarts the measurement
+static void lap(double seconds[STAGE_COUNT], stage stage, double *start)
+{
+    double time = getMonotonicSeconds();
+    seconds[stage] += time - *start;
+    *start = time;
+}
+
+static void runFrame(SimContext *context, const benchmarkCase *benchmark, benchmarkBuffers *buffers, uint64_t frameIndex, double seconds[STAGE_COUNT])
+{
+    int steps = benchmark->approximationSteps;
+    int imageHeight = steps * context->settings.resolutionY;
+    int imageWidth = steps * context->settings.resolutionX;
+    int binnedSize = (context->settings.resolutionX / context->settings.binning) * (context->settings.resolutionY / context->settings.binning);
+    double start = getMonotonicSeconds();
+
+    setFrameIndexCtx(context, frameIndex);
+    if(benchmark->emccd)
+    {
+        createImageEMCCDCtx(context, buffers->binnedImage, (const double (*)[2])buffers->sites, 1, NULL, benchmark->atomCount, steps);
+    }
+    else
+    {
+        createImageCMOSCtx(context, buffers->binnedImage, (const double (*)[2])buffers->sites, 1, NULL, benchmark->atomCount, steps);
+    }
+    lap(seconds, STAGE_FRAME, &start);
+
+    double (*atomLocations)[2] = NULL;
+    unsigned int *siteIndices = NULL;
+    unsigned int atomCount = fillAtomLocations(context, frameIndex, (const double (*)[2])buffers->sites, benchmark->atomCount, &atomLocations, &siteIndices, NULL);
+    double (*normalizedAtomLocations)[2] = context->workspace.normalizedAtomLocations.data;
+    normalizeCameraCoords(context, normalizedAtomLocations, atomLocations, atomCount, 1);
+    real *image = context->workspace.image.data;
+    initImageAndSimulateOpticalEffects(context, frameIndex, image, imageHeight, imageWidth, normalizedAtomLocations, siteIndices, NULL, atomCount, steps);
+    opticsGrid grid = getOpticsGrid(context, steps);
+    real *visibleImage = image + grid.offsetY * grid.width + grid.offsetX;
+    lap(seconds, STAGE_OPTICS, &start);
+
+    if(benchmark->emccd)
+    {
+        samplePhotonsEMCCD(context, frameIndex, visibleImage, grid.width, imageHeight, imageWidth, steps);
+        lap(seconds, STAGE_PHOTONS, &start);
+        readoutEMCCD(context, frameIndex, buffers->binnedImage, visibleImage, grid.width, steps);
+        lap(seconds, STAGE_READOUT, &start);
+        binCounts(context, buffers->binnedCounts, visibleImage, grid.width, steps);
+        lap(seconds, STAGE_BINNING, &start);
+        sampleEMGains(context, frameIndex, buffers->binnedCounts, buffers->gainStreams);
+        lap(seconds, STAGE_EM_GAIN, &start);
+        sampleSCICs(context, buffers->binnedCounts, buffers->gainStreams);
+        lap(seconds, STAGE_SCIC, &start);
+    }
+    else
+    {
+        sampleAndReadoutCMOS(context, frameIndex, buffers->binnedImage, visibleImage, grid.width, steps);
+        lap(seconds, STAGE_READOUT, &start);
+        binCounts(context, buffers->binnedCounts, visibleImage, grid.width, steps);
+        lap(seconds, STAGE_BINNING, &start);
+        memset(buffers->binnedCounts, 0, binnedSize * sizeof(int));
+        start = getMonotonicSeconds();
+        samplePhotonsCMOS(context, frameIndex, visibleImage, grid.width, steps, buffers->binnedCounts);
+        lap(seconds, STAGE_PHOTONS, &start);
+    }
+    sampleReadoutNoise(context, frameIndex, buffers->readoutNoise, benchmark->emccd);
+    lap(seconds, STAGE_READOUT_NOISE, &start);
+}
+
+// Context with the settings of the file and one thread, a missing file would silently benchmark the default settings instead
+static SimContext *createBenchmarkContext(const char *configPath, int resolution)
+{
+    SimContext *context = createSimContext();
+    if(!context || !readConfigCtx(context, configPath))
+    {
+        fprintf(stderr, "Could not read the settings %s\n", configPath);
+        exit(1);
+    }
+    setResolutionCtx(context, resolution, resolution);
+    setSeedCtx(context, 1);
+    setThreadCountCtx(context, 1);
+    return context;
+}
+
+static void runCase(FILE *output, const char *configPath, const benchmarkCase *benchmark, double minTime, _Bool first)
+{
+    SimContext *context = createBenchmarkContext(configPath, benchmark->resolution);
+    setBinningCtx(context, benchmark->binning);
+    reserveWorkspaceCtx(context, benchmark->atomCount, benchmark->approximationSteps);
+
+    int width = context->settings.resolutionX;
+    int binnedSize = (width / benchmark->binning) * (context->settings.resolutionY / benchmark->binning);
+    benchmarkBuffers buffers;
+    buffers.sites = malloc(benchmark->atomCount * sizeof(*buffers.sites));
+    buffers.binnedImage = malloc(binnedSize * sizeof(int));
+    buffers.binnedCounts = calloc(binnedSize, sizeof(int));
+    buffers.gainStreams = malloc(binnedSize * sizeof(randomStream));
+    buffers.readoutNoise = malloc(3 * width * sizeof(double));
+    placeSites(buffers.sites, benchmark->atomCount);
+
+    double seconds[STAGE_COUNT] = {0};
+    runFrame(context, benchmark, &buffers, 0, seconds);
+    memset(seconds, 0, sizeof(seconds));
+    int frames = 0;
+    double start = getMonotonicSeconds();
+    while(frames < MIN_FRAMES || getMonotonicSeconds() - start < minTime)
+    {
+        runFrame(context, benchmark, &buffers, ++frames, seconds);
+    }
+
+    fprintf(output, "%s\n    {\"camera\": \"%s\", \"resolution\": %d, \"approximationSteps\": %d, \"binning\": %d, \"atoms\": %d, \"frames\": %d, "
+        "\"peakMemory\": %zu, \"secondsPerFrame\": {", first ? "" : ",", benchmark->emccd ? "emccd" : "cmos", benchmark->resolution,
+        benchmark->approximationSteps, benchmark->binning, benchmark->atomCount, frames, getPeakMemoryCtx(context));
+    _Bool firstStage = 1;
+    for(int s = 0; s < STAGE_COUNT; s++)
+    {
+        if(seconds[s] > 0)
+        {
+            fprintf(output, "%s\"%s\": %.6e", firstStage ? "" : ", ", stageNames[s], seconds[s] / frames);
+            firstStage = 0;
+        }
+    }
+    fprintf(output, "}}");
+    fflush(output);
+    fprintf(stderr, "%s %dx%d, %d steps, binning %d, %d atoms: %.3e s per frame\n", benchmark->emccd ? "EMCCD" : "CMOS", benchmark->resolution, benchmark->resolution,
+        benchmark->approximationSteps, benchmark->binning, benchmark->atomCount, seconds[STAGE_FRAME] / frames);
+
+    free(buffers.sites);
+    free(buffers.binnedImage);
+    free(buffers.binnedCounts);
+    free(buffers.gainStreams);
+    free(buffers.readoutNoise);
+    freeSimContext(context);
+}
+
+/*
+ * Expected photons per camera pixel before noise of the sites in frame 0, the approximationSteps x approximationSteps subpixels of each pixel summed
+ * Returns the mean seconds of the optics stage producing them
+ */
+static double computeExpectedImage(const char *configPath, double *expected, const double sites[][2], int approximationSteps, _Bool pixelIntegration, double minTime)
+{
+    SimContext *context = createBenchmarkContext(configPath, VALIDATION_RESOLUTION);
+    setPixelIntegrationCtx(context, pixelIntegration);
+    reserveWorkspaceCtx(context, VALIDATION_ATOMS, approximationSteps);
+
+    int imageHeight = approximationSteps * VALIDATION_RESOLUTION;
+    int imageWidth = approximationSteps * VALIDATION_RESOLUTION;
+    opticsGrid grid = getOpticsGrid(context, approximationSteps);
+    real *image = context->workspace.image.data;
+    int frames = 0;
+    double start = getMonotonicSeconds();
+    while(frames < MIN_FRAMES || getMonotonicSeconds() - start < minTime)
+    {
+        initImageAndSimulateOpticalEffects(context, 0, image, imageHeight, imageWidth, sites, NULL, NULL, VALIDATION_ATOMS, approximationSteps);
+        frames++;
+    }
+    double seconds = (getMonotonicSeconds() - start) / frames;
+
+    const real *visibleImage = image + grid.offsetY * grid.width + grid.offsetX;
+    for(int i = 0; i < VALIDATION_RESOLUTION; i++)
+    {
+        for(int j = 0; j < VALIDATION_RESOLUTION; j++)
+        {
+            double photons = 0;
+            for(int y = 0; y < approximationSteps; y++)
+            {
+                for(int x = 0; x < approximationSteps; x++)
+                {
+                    photons += visibleImage[(i * approximationSteps + y) * grid.width + j * approximationSteps + x];
+                }
+            }
+            expected[i * VALIDATION_RESOLUTION + j] = photons;
+        }
+    }
+    freeSimContext(context);
+    return seconds;
+}
+
+/*
+ * Compares the expected images of few approximation steps, with and without pixel integration, to supersampling with the most steps
+ * The errors are the largest difference of a pixel relative to the peak of the reference and the relative L2 norm of the difference
+ */
+static void runPixelIntegrationValidation(FILE *output, const char *configPath, double minTime, _Bool quick)
+{
+    const int approximationSteps[] = {1, 2, 3, 4, 1, 2};
+    const _Bool pixelIntegration[] = {0, 0, 0, 0, 1, 1};
+    int referenceSteps = quick ? VALIDATION_QUICK_REFERENCE_STEPS : VALIDATION_REFERENCE_STEPS;
+    int pixelCount = VALIDATION_RESOLUTION * VALIDATION_RESOLUTION;
+
+    double (*sites)[2] = malloc(VALIDATION_ATOMS * sizeof(*sites));
+    placeSites(sites, VALIDATION_ATOMS);
+    double *reference = malloc(pixelCount * sizeof(double));
+    double *expected = malloc(pixelCount * sizeof(double));
+    computeExpectedImage(configPath, reference, (const double (*)[2])sites, referenceSteps, 0, 0);
+    double peak = 0;
+    double referenceNorm = 0;
+    for(int p = 0; p < pixelCount; p++)
+    {
+        peak = fmax(peak, reference[p]);
+        referenceNorm += reference[p] * reference[p];
+    }
+
+    fprintf(output, ",\n  \"pixelIntegration\": {\"resolution\": %d, \"atoms\": %d, \"referenceSteps\": %d, \"cases\": [",
+        VALIDATION_RESOLUTION, VALIDATION_ATOMS, referenceSteps);
+    for(int c = 0; c < (int)(sizeof(approximationSteps) / sizeof(approximationSteps[0])); c++)
+    {
+        double seconds = computeExpectedImage(configPath, expected, (const double (*)[2])sites, approximationSteps[c], pixelIntegration[c], minTime);
+        double maxError = 0;
+        double errorNorm = 0;
+        for(int p = 0; p < pixelCount; p++)
+        {
+            double error = expected[p] - reference[p];
+            maxError = fmax(maxError, fabs(error));
+            errorNorm += error * error;
+        }
+        fprintf(output, "%s\n    {\"approximationSteps\": %d, \"pixelIntegration\": %s, \"maxError\": %.3e, \"l2Error\": %.3e, \"opticsSeconds\": %.6e}",
+            c ? "," : "", approximationSteps[c], pixelIntegration[c] ? "true" : "false", maxError / peak, sqrt(errorNorm / referenceNorm), seconds);
+        fflush(output);
+        fprintf(stderr, "Pixel integration validation, %d steps%s: max error %.3e, L2 error %.3e, %.3e s optics\n", approximationSteps[c],
+            pixelIntegration[c] ? " integrated" : "", maxError / peak, sqrt(errorNorm / referenceNorm), seconds);
+    }
+    fprintf(output, "\n  ]}");
+
+    free(sites);
+    free(reference);
+    free(expected);
+}
+
+int main(int argc, char **argv)
+{
+    const char *outputPath = NULL;
+    const char *configPath = "simulationSettings.cfg";
+    double minTime = 0.5;
+    _Bool quick = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--quick"))
+        {
+            quick = 1;
+        }
+        else if(!strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--config") && i + 1 < argc)
+        {
+            configPath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--min-time") && i + 1 < argc)
+        {
+            minTime = atof(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: benchmark [--output FILE] [--config FILE] [--min-time SECONDS] [--quick]\n"
+                "Varies resolution, approximation steps, binning and atom count one at a time around 512x512, 1 step, binning 1 and 100 atoms\n"
+                "and compares pixel integration to supersampling on expected images of 256x256 pixels\n");
+            return 1;
+        }
+    }
+    FILE *output = outputPath ? fopen(outputPath, "w") : stdout;
+    if(!output)
+    {
+        fprintf(stderr, "Could not open %s\n", outputPath);
+        return 1;
+    }
+
+    // Sweeps of one parameter each, the first value is the baseline
+    const int resolutions[] = {512, 256, 1024, 2048, 4096};
+    const int approximationSteps[] = {1, 2, 3, 4};
+    const int binnings[] = {1, 2, 3, 4};
+    const int atomCounts[] = {100, 1, 10, 1000, 10000};
+    int resolutionCount = quick ? 3 : 5;
+    int atomCountCount = quick ? 4 : 5;
+
+    time_t now = time(NULL);
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(output, "{\n  \"version\": \"%s\",\n  \"timestamp\": \"%s\",\n  \"singlePrecision\": %s,\n  \"minTime\": %g,\n  \"results\": [",
+        NAIS_VERSION, timestamp, usesSinglePrecision() ? "true" : "false", minTime);
+    _Bool first = 1;
+    for(int emccd = 1; emccd >= 0; emccd--)
+    {
+        benchmarkCase baseline = {emccd, resolutions[0], approximationSteps[0], binnings[0], atomCounts[0]};
+        runCase(output, configPath, &baseline, minTime, first);
+        first = 0;
+        for(int i = 1; i < resolutionCount; i++)
+        {
+            benchmarkCase benchmark = baseline;
+            benchmark.resolution = resolutions[i];
+            runCase(output, configPath, &benchmark, minTime, first);
+        }
+        for(int i = 1; i < 4; i++)
+        {
+            benchmarkCase benchmark = baseline;
+            benchmark.approximationSteps = approximationSteps[i];
+            runCase(output, configPath, &benchmark, minTime, first);
+        }
+        for(int i = 1; i < 4; i++)
+        {
+            benchmarkCase benchmark = baseline;
+            benchmark.binning = binnings[i];
+            runCase(output, configPath, &benchmark, minTime, first);
+        }
+        for(int i = 1; i < atomCountCount; i++)
+        {
+            benchmarkCase benchmark = baseline;
+            benchmark.atomCount = atomCounts[i];
+            runCase(output, configPath, &benchmark, minTime, first);
+        }
+    }
+    fprintf(output, "\n  ]");
+    runPixelIntegrationValidation(output, configPath, minTime, quick);
+    fprintf(output, "\n}\n");
+    if(outputPath)
+    {
+        fclose(output);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -1,70 +1,41 @@
-#include <complex.h>
-#include <fftw3.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include "settings.h"
+#include "simContext.h"
 #include "imageModulation.h"
+#include "fftPlans.h"
+#include "constructPSF.h"
 
-void getConvolutedLightSource(double *psf, int numPixels)
+void getConvolutedLightSourceCtx(SimContext *context, double *psf, int numPixels)
 {
-    memset(psf, 0, numPixels * numPixels * sizeof(double));
+    real *image = FFTW(alloc_real)(numPixels * numPixels);
+    memset(image, 0, numPixels * numPixels * sizeof(real));
 
     double middle = (double)(numPixels - 1) / 2.;
-    double gaussianNormalizationFactor = 1;
-    if(simulationSettings.lightSourceStdev > 0)
-    {
-        gaussianNormalizationFactor = 1 / (2 * M_PI * simulationSettings.lightSourceStdev * simulationSettings.lightSourceStdev);
-        for(int i = 0; i < numPixels; i++)
-        {
-            for(int j = 0; j < numPixels; j++)
-            {
-                psf[i * numPixels + j] = gaussianNormalizationFactor * pow(M_E, -((i - middle) * (i - middle) + (j - middle) * (j - middle)) / 
-                    (2 * simulationSettings.lightSourceStdev * simulationSettings.lightSourceStdev));
-            }
-        }
-    }
-    else
+    addLightSource(image, numPixels, numPixels, middle, middle, 1, context->settings.lightSourceStdev, getPointSourceSpread(context, context->settings.pixelSize));
+    simulateOptics(context, image, numPixels, numPixels, context->settings.pixelSize, context->settings.lightSourceStdev, 1);
+
+    for(int i = 0; i < numPixels * numPixels; i++)
     {
-        psf[((int)middle) * numPixels + (int)middle] = 1;
+        psf[i] = image[i];
     }
-    simulateOptics(psf, numPixels, numPixels, simulationSettings.pixelSize, 1);
+    FFTW(free)(image);
 }
 
-void getPSF(double *psf, int numPixels)
+void getPSFCtx(SimContext *context, double *psf, int numPixels)
 {
-    double pupilRadius = numPixels * simulationSettings.physicalPixelSize / simulationSettings.magnification * simulationSettings.numericalAperture / simulationSettings.wavelength;   // Pupil radius in pixels
+    double pupilRadius = numPixels * context->settings.physicalPixelSize / context->settings.magnification * context->settings.numericalAperture / context->settings.wavelength;   // Pupil radius in pixels
 
     // Allocating buffer memory
     // INEFFICIENT, buffers are only used once to make code readable
     // CHANGE FOR FINAL VERSION!
-    fftw_complex *pupil = fftw_alloc_complex(numPixels * numPixels);
-    fftw_complex *psfC = fftw_alloc_complex(numPixels * numPixels);
+    fftComplex *pupil = FFTW(alloc_complex)(numPixels * numPixels);
+    fftComplex *psfC = FFTW(alloc_complex)(numPixels * numPixels);
     
     // Construct complex pupil and apply fft to get psf
-    fftw_plan p = fftw_plan_dft_2d(numPixels, numPixels, pupil, psfC, FFTW_FORWARD, FFTW_ESTIMATE);
-    for (int i = 0; i < numPixels; i++)
-    {
-        for(int j = 0; j < numPixels; j++)
-        {
-            double y = i - (numPixels - 1) / 2;
-            double x = j - (numPixels - 1) / 2;
-            double r = sqrt(x * x + y * y);
-            if(r < pupilRadius)
-            {
-                double theta = atan2(y, x);
-                double phase = 2 * M_PI / simulationSettings.wavelength * ZernikePhase(r / pupilRadius, theta, simulationSettings.zernikeCoefficients);
-                pupil[i * numPixels + j] = cos(phase) + sin(phase) * I;
-            }
-            else
-            {
-                pupil[i * numPixels + j] = 0;
-            }
-        }
-    }
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    fillPupil(context, &context->psfZernikeBasis, pupil, numPixels, numPixels, (numPixels - 1) / 2, (numPixels - 1) / 2, 1, 1, pupilRadius);
+    FFTW(execute_dft)(getFFTPlan(FFT_FORWARD, numPixels, numPixels), pupil, psfC);
 
     double sum = 0;
     // Finalize psf and apply ifftshift
@@ -85,6 +56,16 @@ void getPSF(double *psf, int numPixels)
         }
     }
 
-    fftw_free(pupil);
-    fftw_free(psfC);
+    FFTW(free)(pupil);
+    FFTW(free)(psfC);
+}
+
+void getConvolutedLightSource(double *psf, int numPixels)
+{
+    getConvolutedLightSourceCtx(getDefaultSimContext(), psf, numPixels);
+}
+
+void getPSF(double *psf, int numPixels)
+{
+    getPSFCtx(getDefaultSimContext(), psf, numPixels);
 }
\ No newline at end of file
@@ -3,82 +3,69 @@
 #include <string.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
-#include "settings.h"
+#include "simContext.h"
 #include "distributionSampling.h"
 #include "imageModulation.h"
+#include "createSampleImage.h"
+#include "platformThreads.h"
 
 #define EulerMascheroni 0.5772156649015328606065120900824024310422
 
-void initImageAndSimulateOpticalEffects(double *image, int imageHeight, int imageWidth, const double atomLocations[][2], 
-    double *truth, const double zernikeCoefficients[15], int atomCount, int approximationSteps)
+static double sampleAtomBrightness(const SimContext *context, uint64_t frameIndex, unsigned int site, double *truth)
 {
-    double fractionalSolidAngle = (1 - sqrt(1 - simulationSettings.numericalAperture * simulationSettings.numericalAperture)) / 2;
-    double photonsPerAtom = fractionalSolidAngle * simulationSettings.scatteringRate * simulationSettings.exposureTime * simulationSettings.quantumEfficiency;
-
-    memset(image, 0, imageWidth * imageHeight * sizeof(double) * 4);
-
-    double gaussianNormalizationFactor = 1;
-    double effectiveLightSourceStdev = simulationSettings.lightSourceStdev * approximationSteps;
-    if(effectiveLightSourceStdev > 0)
+    randomStream random;
+    initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_BRIGHTNESS, site);
+    double brightness = 1;
+    if(randomZeroToOne(&random) > context->settings.survivalProbability)
     {
-        gaussianNormalizationFactor = 1 / (2 * M_PI * effectiveLightSourceStdev * effectiveLightSourceStdev);
+        brightness = sampleTimeOfAtomLossImaging(&random, context->settings.survivalProbability);
+        if(truth)
+        {
+            *truth = brightness;
+        }
     }
+    return brightness;
+}
+
+// siteIndices maps the atoms to their sites, it selects the random streams and the truth entries, NULL means identity
+void initImageAndSimulateOpticalEffects(SimContext *context, uint64_t frameIndex, real *image, int imageHeight, int imageWidth, const double atomLocations[][2], 
+    const unsigned int *siteIndices, double *truth, int atomCount, int approximationSteps)
+{
+    double photonsPerAtom = getPhotonsPerAtom(context);
+
+    opticsGrid grid = getOpticsGrid(context, approximationSteps);
+    memset(image, 0, grid.height * grid.width * sizeof(real));
 
+    double effectiveLightSourceStdev = context->settings.lightSourceStdev * approximationSteps;
+    double pointSpread = getPointSourceSpread(context, context->settings.pixelSize / approximationSteps);
+
+    STATS_START_TIMER(lightSourceStart);
     unsigned short anyAtomWithinSight = 0;
     for (int a = 0; a < atomCount; a++)
     {
-        if(truth)
-        {
-            while((*truth) < 0.5)
-            {
-                truth++;
-            }
-        }
+        unsigned int site = siteIndices ? siteIndices[a] : (unsigned int)a;
         double x = imageWidth * atomLocations[a][0];
         double y = imageHeight * atomLocations[a][1];
         if(x >= 0 && y >= 0 && x < imageWidth && y < imageHeight)
         {
-            y += imageHeight / 2;
-            x += imageWidth / 2;
+            // Pixel k covers [k, k + 1), while addLightSource places points relative to the pixel centers
+            y += grid.offsetY - 0.5;
+            x += grid.offsetX - 0.5;
             anyAtomWithinSight = 1;
-            double brightness = 1;
-            if(randomZeroToOne() > simulationSettings.survivalProbability)
-            {
-                brightness = sampleTimeOfAtomLossImaging(simulationSettings.survivalProbability);
-                if(truth)
-                {
-                    *truth = brightness;
-                }
-            }
-            if(effectiveLightSourceStdev > 0)
-            {
-                for(int yi = 0; yi < 2 * imageHeight; yi++)
-                {
-                    for(int xi = 0; xi < 2 * imageWidth; xi++)
-                    {
-                        image[yi * imageWidth * 2 + xi] += brightness * gaussianNormalizationFactor * 
-                            pow(M_E, -((xi - x) * (xi - x) + (yi - y) * (yi - y)) / (2 * effectiveLightSourceStdev * effectiveLightSourceStdev));
-                    }
-                }
-            }
-            else
-            {
-                image[(int)y * imageWidth * 2 + (int)x] += brightness;
-            }
-        }
-        if(truth)
-        {
-            truth++;
+            double brightness = sampleAtomBrightness(context, frameIndex, site, truth ? &truth[site] : NULL);
+            addLightSource(image, grid.height, grid.width, x, y, brightness, effectiveLightSourceStdev, pointSpread);
         }
     }
+    STATS_ADD_TIME(context, lightSourceSeconds, lightSourceStart);
 
     if(anyAtomWithinSight)
     {
-        simulateOptics(image, imageHeight * 2, imageWidth * 2, simulationSettings.pixelSize / approximationSteps, photonsPerAtom);
+        simulateOptics(context, image, grid.height, grid.width, context->settings.pixelSize / approximationSteps, effectiveLightSourceStdev, photonsPerAtom);
     }
 }
 
-double fillAtomLocations(const double potentialAtomLocations[][2], unsigned int potentialAtomCount, double (**filledAtomLocations)[2], double *truth)
+double fillAtomLocations(SimContext *context, uint64_t frameIndex, const double potentialAtomLocations[][2], unsigned int potentialAtomCount, 
+    double (**filledAtomLocations)[2], unsigned int **siteIndices, double *truth)
 {
     if (!potentialAtomLocations || !potentialAtomCount)
     {
@@ -87,14 +74,17 @@ double fillAtomLocations(const double potentialAtomLocations[][2], unsigned int
     else
     {
         int atomCount = 0;
-        int bitsPerInt = 8 * sizeof(unsigned int);
-        unsigned int *atomSiteMasks = calloc(1 + potentialAtomCount / bitsPerInt, sizeof(unsigned int));
-        for (int i = 0; i < potentialAtomCount; i++)
+        *filledAtomLocations = context->workspace.atomLocations.data;
+        *siteIndices = context->workspace.siteIndices.data;
+        for (unsigned int i = 0; i < potentialAtomCount; i++)
         {
-            if (randomZeroToOne() <= simulationSettings.fillingRatio)
+            randomStream random;
+            initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_OCCUPANCY, i);
+            if (randomZeroToOne(&random) <= context->settings.fillingRatio)
             {
-                atomSiteMasks[i / bitsPerInt] |= 1 << (i % bitsPerInt);
-                atomCount++;
+                (*filledAtomLocations)[atomCount][0] = potentialAtomLocations[i][0];
+                (*filledAtomLocations)[atomCount][1] = potentialAtomLocations[i][1];
+                (*siteIndices)[atomCount++] = i;
                 if(truth)
                 {
                     truth[i] = 1;
@@ -108,27 +98,16 @@ double fillAtomLocations(const double potentialAtomLocations[][2], unsigned int
                 }
             }
         }
-        int index = 0;
-        *filledAtomLocations = malloc(sizeof(double[atomCount][2]));
-        for(int i = 0; i < potentialAtomCount; i++)
-        {
-            if (atomSiteMasks[i / bitsPerInt] & 1 << (i % bitsPerInt))
-            {
-                (*filledAtomLocations)[index][0] = potentialAtomLocations[i][0];
-                (*filledAtomLocations)[index++][1] = potentialAtomLocations[i][1];
-            }
-        }
-        free(atomSiteMasks);
         return atomCount;
     }
 }
 
-void normalizeCameraCoords(double normalizedAtomLocations[][2], double atomLocations[][2], int atomCount, unsigned short cameraCoords)
+void normalizeCameraCoords(const SimContext *context, double normalizedAtomLocations[][2], double atomLocations[][2], int atomCount, unsigned short cameraCoords)
 {
     if(!cameraCoords)
     {
-        double fovWidth = simulationSettings.resolutionX * simulationSettings.physicalPixelSize / simulationSettings.magnification;
-        double fovHeight = simulationSettings.resolutionY * simulationSettings.physicalPixelSize / simulationSettings.magnification;
+        double fovWidth = context->settings.resolutionX * context->settings.physicalPixelSize / context->settings.magnification;
+        double fovHeight = context->settings.resolutionY * context->settings.physicalPixelSize / context->settings.magnification;
         for (int i = 0; i < atomCount; i++)
         {
             normalizedAtomLocations[i][0] = atomLocations[i][0] / fovWidth;
@@ -141,163 +120,559 @@ void normalizeCameraCoords(double normalizedAtomLocations[][2], double atomLocat
     }
 }
 
-void createImageEMCCD(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+// Sample light plus spurious charges, only one sampling due to reproductivity of poissonian distribution
+void samplePhotonsEMCCD(SimContext *context, uint64_t frameIndex, real *image, int rowStride, int imageHeight, int imageWidth, int approximationSteps)
 {
-    double gamma = pow(1 + simulationSettings.p0, simulationSettings.numberGainRegisters);
-
-    int imageHeight = approximationSteps * simulationSettings.resolutionY;
-    int imageWidth = approximationSteps * simulationSettings.resolutionX;
-
-    double (*atomLocations)[2] = NULL;
-    unsigned int atomCount = fillAtomLocations(potentialAtomLocations, potentialAtomCount, &atomLocations, truth);
-
-    double (*normalizedAtomLocations)[2] = malloc(atomCount * 2 * sizeof(double));
-    normalizeCameraCoords(normalizedAtomLocations, atomLocations, atomCount, cameraCoords);
-
-    double *image = malloc(imageHeight * imageWidth * sizeof(double) * 4); // Times 4 since the array has to be zero-padded to circumvent wraparound errors from the convolution
-    initImageAndSimulateOpticalEffects(image, imageHeight, imageWidth, normalizedAtomLocations, truth, simulationSettings.zernikeCoefficients, atomCount, approximationSteps);
-
-    for (int i = imageHeight / 2; i < imageHeight + imageHeight / 2; i++)
+    STATS_START_TIMER(start);
+    double spuriousCharges = ((context->settings.strayLightRate + context->settings.darkCurrentRate) * context->settings.exposureTime + context->settings.cicChance) / (approximationSteps * approximationSteps);
+    for (int i = 0; i < imageHeight; i++)
     {
-        for(int j = imageWidth / 2; j < imageWidth + imageWidth / 2; j++)
+        for(int j = 0; j < imageWidth; j++)
         {
-            // Sample light plus spurious charges, only one sampling due to reproductivity of poissonian distribution
-            image[i * imageWidth * 2 + j] = samplePoisson(image[i * imageWidth * 2 + j] + ((simulationSettings.strayLightRate + simulationSettings.darkCurrentRate) * simulationSettings.exposureTime + simulationSettings.cicChance) / (approximationSteps * approximationSteps));
+            randomStream random;
+            initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_PHOTONS, i * imageWidth + j);
+            image[i * rowStride + j] = samplePoisson(&random, image[i * rowStride + j] + spuriousCharges);
         }
     }
+    STATS_COUNT(context, poissonDraws, (uint64_t)imageHeight * imageWidth);
+    STATS_ADD_TIME(context, photonSeconds, start);
+}
+
+// Electrons from spurious charges that are created within the gain register and amplified by its remaining stages
+int sampleSCICElectrons(SimContext *context, randomStream *random)
+{
+    double sCICChance = context->settings.numberGainRegisters * context->settings.sCICChance * pow(context->settings.sCICChance, context->settings.numberGainRegisters - 1);    // Gets updated each loop iteration to follow binomial distribution
+    int electrons = 0;
+    int sCICCharges = 0;
+    while(randomZeroToOne(random) < sCICChance)
+    {
+        int remainingStages = randomZeroToOne(random) * context->settings.numberGainRegisters;
+        electrons += sampleEMGain(random, 1, pow(context->settings.p0, remainingStages));
+        sCICCharges++;
+        sCICChance = (context->settings.numberGainRegisters - sCICCharges) / (sCICCharges + 1) * context->settings.sCICChance / (1 - context->settings.sCICChance);
+    }
+    STATS_COUNT(context, sCICEvents, sCICCharges);
+    STATS_COUNT(context, emGainSamples, sCICCharges);
+    return electrons;
+}
+
+void readoutEMCCD(SimContext *context, uint64_t frameIndex, int *binnedImage, const real *image, int rowStride, int approximationSteps)
+{
+    STATS_START_TIMER(start);
+    double gamma = pow(1 + context->settings.p0, context->settings.numberGainRegisters);
+    int binnedWidth = context->settings.resolutionX / context->settings.binning;
+    double *readoutNoise = context->workspace.readoutNoise.data;
 
     // Binning, emGain and readout
-    for (int i = 0; i < simulationSettings.resolutionY / simulationSettings.binning; i++)
+    for (int i = 0; i < context->settings.resolutionY / context->settings.binning; i++)
     {
-        for(int j = 0; j < simulationSettings.resolutionX / simulationSettings.binning; j++)
+        randomStream rowRandom;
+        initRandomStream(&rowRandom, context->seed, frameIndex, RANDOM_DOMAIN_READOUT, i);
+        fillGaussian(&rowRandom, readoutNoise, binnedWidth, context->settings.biasClamp, context->settings.readoutStdev);
+
+        for(int j = 0; j < context->settings.resolutionX / context->settings.binning; j++)
         {
+            randomStream random;
+            initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_GAIN, i * binnedWidth + j);
+
             // Binning
             int electrons = 0;
 
-            for(int y = 0; y < simulationSettings.binning * approximationSteps; y++)
+            for(int y = 0; y < context->settings.binning * approximationSteps; y++)
             {
-                for(int x = 0; x < simulationSettings.binning * approximationSteps; x++)
+                for(int x = 0; x < context->settings.binning * approximationSteps; x++)
                 {
-                    electrons += image[(imageHeight / 2 + i * simulationSettings.binning * approximationSteps + y) * imageWidth * 2 + imageWidth / 2 + j * simulationSettings.binning * approximationSteps + x];
+                    electrons += image[(i * context->settings.binning * approximationSteps + y) * rowStride + j * context->settings.binning * approximationSteps + x];
                 }
             }
 
             // Sample em gain
-            electrons = sampleEMGain(electrons, gamma);
+            STATS_COUNT(context, emGainSamples, electrons > 0);
+            electrons = sampleEMGain(&random, electrons, gamma);
 
             // Sample sCIC
-            double sCICChance = simulationSettings.numberGainRegisters * simulationSettings.sCICChance * pow(simulationSettings.sCICChance, simulationSettings.numberGainRegisters - 1);    // Gets updated each loop iteration to follow binomial distribution
-            int sCICCharges = 0;
-            while(randomZeroToOne() < sCICChance)
-            {
-                int remainingStages = randomZeroToOne() * simulationSettings.numberGainRegisters;
-                electrons += sampleEMGain(1, pow(simulationSettings.p0, remainingStages));
-                sCICCharges++;
-                sCICChance = (simulationSettings.numberGainRegisters - sCICCharges) / (sCICCharges + 1) * simulationSettings.sCICChance / (1 - simulationSettings.sCICChance);
-            }
+            electrons += sampleSCICElectrons(context, &random);
 
             // Sample readout
-            electrons = sampleGaussian(electrons / simulationSettings.preampgain + simulationSettings.biasClamp, simulationSettings.readoutStdev);
+            electrons = electrons / context->settings.preampgain + readoutNoise[j];
 
-            binnedImage[i * simulationSettings.resolutionX / simulationSettings.binning + j] = electrons;
+            binnedImage[i * binnedWidth + j] = electrons;
         }
     }
-
-    free(image);
-    free(atomLocations);
-    free(normalizedAtomLocations);
+    STATS_ADD_TIME(context, readoutSeconds, start);
 }
 
-void createImageCMOS(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+/*
+ * Photon sampling, readout and binning in one pass over the visible pixels, writing straight into binnedImage
+ * The sub-pixels of a camera pixel are read out together, so they share one Poisson draw and one dark current draw,
+ * the sum of k^2 Gamma(alpha, beta) dark currents being Gamma(k^2 alpha, beta) distributed
+ */
+void sampleAndReadoutCMOS(SimContext *context, uint64_t frameIndex, int *binnedImage, const real *image, int rowStride, int approximationSteps)
 {
-    int imageHeight = approximationSteps * simulationSettings.resolutionY;
-    int imageWidth = approximationSteps * simulationSettings.resolutionX;
-
-    double (*atomLocations)[2] = NULL;
-    unsigned int atomCount = fillAtomLocations(potentialAtomLocations, potentialAtomCount, &atomLocations, truth);
-
-    double (*normalizedAtomLocations)[2] = malloc(atomCount * 2 * sizeof(double));
-    normalizeCameraCoords(normalizedAtomLocations, atomLocations, atomCount, cameraCoords);
-
-    double *image = malloc(imageHeight * imageWidth * sizeof(double) * 4); // Times 4 since the array has to be zero-padded to circumvent wraparound errors from the convolution
-    initImageAndSimulateOpticalEffects(image, imageHeight, imageWidth, normalizedAtomLocations, truth, simulationSettings.zernikeCoefficients, atomCount, approximationSteps);
-
-    for (int i = 0; i < imageHeight * 2; i++)
-    {
-        for(int j = 0; j < imageWidth * 2; j++)
-        {
-            double darkCurrent = sampleGamma(simulationSettings.darkCurrentSamplingAlpha, simulationSettings.darkCurrentSamplingBeta);
-            // Sample light plus spurious charges, only one sampling due to reproductivity of poissonian distribution
-            image[i * imageWidth * 2 + j] = samplePoisson(image[i * imageWidth * 2 + j] + 
-                ((simulationSettings.strayLightRate + darkCurrent) * simulationSettings.exposureTime) / (approximationSteps * approximationSteps));
-        }
-    }
-
-    double *columnNoises = malloc(simulationSettings.resolutionX * sizeof(double));
+    int width = context->settings.resolutionX;
+    int binning = context->settings.binning;
+    int binnedWidth = width / binning;
+    int binnedHeight = context->settings.resolutionY / binning;
+    int subPixels = approximationSteps * approximationSteps;
+    double darkCurrentShape = context->settings.darkCurrentSamplingAlpha * subPixels;
+    STATS_START_TIMER(start);
+
+    double *columnNoises = context->workspace.columnNoises.data;
     // Set location of gumbel distribution so its mean is zero
-    double zeroMeanGumbelLocation = -simulationSettings.columnNoiseScale * EulerMascheroni;
-    for(int j = 0; j < simulationSettings.resolutionX; j++)
-    {
-        columnNoises[j] = sampleGumbel(zeroMeanGumbelLocation, simulationSettings.columnNoiseScale);
-    }
+    randomStream columnRandom;
+    initRandomStream(&columnRandom, context->seed, frameIndex, RANDOM_DOMAIN_COLUMN_NOISE, 0);
+    fillGumbel(&columnRandom, columnNoises, width, -context->settings.columnNoiseScale * EulerMascheroni, context->settings.columnNoiseScale);
 
-    // Readout
-    for (int i = 0; i < simulationSettings.resolutionY; i++)
+    double *readoutNoise = context->workspace.readoutNoise.data;
+    double *biases = readoutNoise;
+    double *flickerNoises = readoutNoise + width;
+    double *readoutNoises = readoutNoise + 2 * width;
+
+    memset(binnedImage, 0, binnedWidth * binnedHeight * sizeof(int));
+    for (int i = 0; i < binnedHeight * binning; i++)
     {
-        double rowNoise = sampleGaussian(0, simulationSettings.rowNoiseStdev);
-        for(int j = 0; j < simulationSettings.resolutionX; j++)
+        randomStream rowRandom;
+        initRandomStream(&rowRandom, context->seed, frameIndex, RANDOM_DOMAIN_ROW_NOISE, i);
+        double rowNoise = sampleGaussian(&rowRandom, 0, context->settings.rowNoiseStdev);
+
+        randomStream readoutRandom;
+        initRandomStream(&readoutRandom, context->seed, frameIndex, RANDOM_DOMAIN_READOUT, i);
+        fillGaussian(&readoutRandom, biases, width, context->settings.biasClamp, context->settings.biasStdev);
+        fillGumbel(&readoutRandom, flickerNoises, width, -context->settings.flickerNoiseScale * EulerMascheroni, context->settings.flickerNoiseScale);
+        fillGaussian(&readoutRandom, readoutNoises, width, 0, context->settings.readoutStdev);
+
+        int *binnedRow = binnedImage + (i / binning) * binnedWidth;
+        for(int j = 0; j < binnedWidth * binning; j++)
         {
-            // Binning approximation steps
-            int electrons = 0;
-
+            double light = 0;
             for(int y = 0; y < approximationSteps; y++)
             {
                 for(int x = 0; x < approximationSteps; x++)
                 {
-                    electrons += image[(imageHeight / 2 + i * approximationSteps + y) * imageWidth * 2 + imageWidth / 2 + j * approximationSteps + x];
+                    light += image[(i * approximationSteps + y) * rowStride + j * approximationSteps + x];
                 }
             }
 
+            // Sample light plus spurious charges, only one sampling due to reproductivity of poissonian distribution
+            randomStream random;
+            initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_PHOTONS, i * width + j);
+            double darkCurrent = sampleGamma(&random, darkCurrentShape, context->settings.darkCurrentSamplingBeta) / subPixels;
+            int electrons = samplePoisson(&random, light + (context->settings.strayLightRate + darkCurrent) * context->settings.exposureTime);
+
             // Sample readout
-            double bias = sampleGaussian(simulationSettings.biasClamp, simulationSettings.biasStdev);
+            double bias = biases[j];
             if(bias < 0)
             {
                 bias = 0;
             }
             
             // Flicker, row and column noise
-            zeroMeanGumbelLocation = -simulationSettings.flickerNoiseScale * EulerMascheroni;
-            electrons += sampleGumbel(zeroMeanGumbelLocation, simulationSettings.flickerNoiseScale);
+            electrons += flickerNoises[j];
             electrons += rowNoise + columnNoises[j];
 
-            electrons = sampleGaussian(electrons / simulationSettings.preampgain + bias, simulationSettings.readoutStdev);
+            electrons = electrons / context->settings.preampgain + bias + readoutNoises[j];
 
-            image[(imageHeight / 2 + i * approximationSteps) * imageWidth * 2 + imageWidth / 2 + j * approximationSteps] = electrons;
+            binnedRow[j / binning] += electrons;
         }
     }
+    STATS_COUNT(context, poissonDraws, (uint64_t)binnedHeight * binning * binnedWidth * binning);
+    STATS_ADD_TIME(context, readoutSeconds, start);
+}
 
-    // Binning
-    for (int i = 0; i < simulationSettings.resolutionY / simulationSettings.binning; i++)
+// Expected photons per camera pixel, obtained by adding the precomputed footprints of all filled sites
+static void renderAtomLayout(SimContext *context, uint64_t frameIndex, real *image, atomLayout *layout, double *truth)
+{
+    updateAtomLayout(context, layout);
+
+    STATS_START_TIMER(start);
+    double photonsPerAtom = getPhotonsPerAtom(context);
+    memset(image, 0, context->settings.resolutionX * context->settings.resolutionY * sizeof(real));
+    for(unsigned int s = 0; s < layout->siteCount; s++)
     {
-        for(int j = 0; j < simulationSettings.resolutionX / simulationSettings.binning; j++)
+        randomStream random;
+        initRandomStream(&random, context->seed, frameIndex, RANDOM_DOMAIN_OCCUPANCY, s);
+        _Bool filled = randomZeroToOne(&random) <= context->settings.fillingRatio;
+        if(truth)
         {
-            int electrons = 0;
-
-            for(int y = 0; y < simulationSettings.binning; y++)
+            truth[s] = filled;
+        }
+        const siteFootprint *footprint = &layout->footprints[s];
+        if(filled && footprint->width)
+        {
+            double photons = sampleAtomBrightness(context, frameIndex, s, truth ? &truth[s] : NULL) * photonsPerAtom;
+            for(int i = 0; i < footprint->height; i++)
             {
-                for(int x = 0; x < simulationSettings.binning; x++)
+                real *imageRow = image + (footprint->y + i) * context->settings.resolutionX + footprint->x;
+                const real *footprintRow = footprint->values + i * footprint->width;
+                for(int j = 0; j < footprint->width; j++)
                 {
-                    electrons += image[(imageHeight / 2 + i * simulationSettings.binning * approximationSteps + y * approximationSteps) * imageWidth * 2 + 
-                        imageWidth / 2 + j * simulationSettings.binning * approximationSteps + x * approximationSteps];
+                    imageRow[j] += photons * footprintRow[j];
                 }
             }
+        }
+    }
+    STATS_ADD_TIME(context, lightSourceSeconds, start);
+}
+
+/*
+ * Reserve every buffer a frame of the current resolution needs, these are only allocated if they have to grow
+ * approximationSteps = 0 is used for frames of precomputed layouts, which need no optical simulation
+ */
+static void reserveFrameWorkspace(SimContext *context, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    workspace *workspace = &context->workspace;
+    int width = context->settings.resolutionX;
+    if(approximationSteps)
+    {
+        // The array has to be zero-padded to circumvent wraparound errors from the convolution
+        opticsGrid grid = getOpticsGrid(context, approximationSteps);
+        reserveWorkspaceBuffer(&workspace->image, grid.height * grid.width * sizeof(real));
+        reserveOpticsWorkspace(workspace, grid.height, grid.width);
+    }
+    else
+    {
+        reserveWorkspaceBuffer(&workspace->image, width * context->settings.resolutionY * sizeof(real));
+    }
+    reserveWorkspaceBuffer(&workspace->atomLocations, potentialAtomCount * 2 * sizeof(double));
+    reserveWorkspaceBuffer(&workspace->normalizedAtomLocations, potentialAtomCount * 2 * sizeof(double));
+    reserveWorkspaceBuffer(&workspace->siteIndices, potentialAtomCount * sizeof(unsigned int));
+    reserveWorkspaceBuffer(&workspace->columnNoises, width * sizeof(double));
+    reserveWorkspaceBuffer(&workspace->readoutNoise, 3 * width * sizeof(double));
+}
+
+static void createFrameEMCCD(SimContext *context, uint64_t frameIndex, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    STATS_START_TIMER(frameStart);
+    reserveFrameWorkspace(context, potentialAtomCount, approximationSteps);
+    int imageHeight = approximationSteps * context->settings.resolutionY;
+    int imageWidth = approximationSteps * context->settings.resolutionX;
+
+    double (*atomLocations)[2] = NULL;
+    unsigned int *siteIndices = NULL;
+    unsigned int atomCount = fillAtomLocations(context, frameIndex, potentialAtomLocations, potentialAtomCount, &atomLocations, &siteIndices, truth);
+
+    double (*normalizedAtomLocations)[2] = context->workspace.normalizedAtomLocations.data;
+    normalizeCameraCoords(context, normalizedAtomLocations, atomLocations, atomCount, cameraCoords);
+
+    real *image = context->workspace.image.data;
+    initImageAndSimulateOpticalEffects(context, frameIndex, image, imageHeight, imageWidth, normalizedAtomLocations, siteIndices, truth, atomCount, approximationSteps);
+
+    opticsGrid grid = getOpticsGrid(context, approximationSteps);
+    real *visibleImage = image + grid.offsetY * grid.width + grid.offsetX;
+    samplePhotonsEMCCD(context, frameIndex, visibleImage, grid.width, imageHeight, imageWidth, approximationSteps);
+    readoutEMCCD(context, frameIndex, binnedImage, visibleImage, grid.width, approximationSteps);
+    STATS_COUNT(context, frames, 1);
+    STATS_ADD_TIME(context, frameSeconds, frameStart);
+}
+
+static void createFrameCMOS(SimContext *context, uint64_t frameIndex, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    STATS_START_TIMER(frameStart);
+    reserveFrameWorkspace(context, potentialAtomCount, approximationSteps);
+    int imageHeight = approximationSteps * context->settings.resolutionY;
+    int imageWidth = approximationSteps * context->settings.resolutionX;
+
+    double (*atomLocations)[2] = NULL;
+    unsigned int *siteIndices = NULL;
+    unsigned int atomCount = fillAtomLocations(context, frameIndex, potentialAtomLocations, potentialAtomCount, &atomLocations, &siteIndices, truth);
+
+    double (*normalizedAtomLocations)[2] = context->workspace.normalizedAtomLocations.data;
+    normalizeCameraCoords(context, normalizedAtomLocations, atomLocations, atomCount, cameraCoords);
+
+    real *image = context->workspace.image.data;
+    initImageAndSimulateOpticalEffects(context, frameIndex, image, imageHeight, imageWidth, normalizedAtomLocations, siteIndices, truth, atomCount, approximationSteps);
+
+    opticsGrid grid = getOpticsGrid(context, approximationSteps);
+    real *visibleImage = image + grid.offsetY * grid.width + grid.offsetX;
+    sampleAndReadoutCMOS(context, frameIndex, binnedImage, visibleImage, grid.width, approximationSteps);
+    STATS_COUNT(context, frames, 1);
+    STATS_ADD_TIME(context, frameSeconds, frameStart);
+}
 
-            binnedImage[i * simulationSettings.resolutionX / simulationSettings.binning + j] = electrons;
+// Variants for fixed site layouts, these skip the optical simulation and only add up precomputed footprints
+static void createFrameEMCCDFromLayout(SimContext *context, uint64_t frameIndex, int *binnedImage, atomLayout *layout, double *truth)
+{
+    STATS_START_TIMER(frameStart);
+    reserveFrameWorkspace(context, 0, 0);
+    real *image = context->workspace.image.data;
+    renderAtomLayout(context, frameIndex, image, layout, truth);
+
+    samplePhotonsEMCCD(context, frameIndex, image, context->settings.resolutionX, context->settings.resolutionY, context->settings.resolutionX, 1);
+    readoutEMCCD(context, frameIndex, binnedImage, image, context->settings.resolutionX, 1);
+    STATS_COUNT(context, frames, 1);
+    STATS_ADD_TIME(context, frameSeconds, frameStart);
+}
+
+static void createFrameCMOSFromLayout(SimContext *context, uint64_t frameIndex, int *binnedImage, atomLayout *layout, double *truth)
+{
+    STATS_START_TIMER(frameStart);
+    reserveFrameWorkspace(context, 0, 0);
+    real *image = context->workspace.image.data;
+    renderAtomLayout(context, frameIndex, image, layout, truth);
+
+    sampleAndReadoutCMOS(context, frameIndex, binnedImage, image, context->settings.resolutionX, 1);
+    STATS_COUNT(context, frames, 1);
+    STATS_ADD_TIME(context, frameSeconds, frameStart);
+}
+
+/*
+ * Allocate the workspaces of the context and its batch threads as well as the optical caches for frames of the current settings
+ * Pass approximationSteps = 0 if only precomputed layouts are used, getPeakMemory reports the resulting memory use
+ */
+void reserveWorkspaceCtx(SimContext *context, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    if(approximationSteps)
+    {
+        opticsGrid grid = getOpticsGrid(context, approximationSteps);
+        prepareOptics(context, grid.height, grid.width, context->settings.pixelSize / approximationSteps);
+    }
+    reserveFrameWorkspace(context, potentialAtomCount, approximationSteps);
+
+    int threadCount = getBatchThreadCount(context);
+    workspace *threadWorkspaces = reserveThreadWorkspaces(context, threadCount - 1);
+    for(int t = 0; t < threadCount - 1; t++)
+    {
+        SimContext threadContext = *context;
+        threadContext.workspace = threadWorkspaces[t];
+        reserveFrameWorkspace(&threadContext, potentialAtomCount, approximationSteps);
+        threadWorkspaces[t] = threadContext.workspace;
+    }
+}
+
+void reserveWorkspace(unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    reserveWorkspaceCtx(getDefaultSimContext(), potentialAtomCount, approximationSteps);
+}
+
+void createImageEMCCDCtx(SimContext *context, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    STATS_BEGIN_CALL(context);
+    createFrameEMCCD(context, context->frameIndex++, binnedImage, potentialAtomLocations, cameraCoords, truth, potentialAtomCount, approximationSteps);
+    STATS_END_CALL(context);
+}
+
+void createImageCMOSCtx(SimContext *context, int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    STATS_BEGIN_CALL(context);
+    createFrameCMOS(context, context->frameIndex++, binnedImage, potentialAtomLocations, cameraCoords, truth, potentialAtomCount, approximationSteps);
+    STATS_END_CALL(context);
+}
+
+void createImageEMCCDFromLayoutCtx(SimContext *context, int *binnedImage, atomLayout *layout, double *truth)
+{
+    STATS_BEGIN_CALL(context);
+    createFrameEMCCDFromLayout(context, context->frameIndex++, binnedImage, layout, truth);
+    STATS_END_CALL(context);
+}
+
+void createImageCMOSFromLayoutCtx(SimContext *context, int *binnedImage, atomLayout *layout, double *truth)
+{
+    STATS_BEGIN_CALL(context);
+    createFrameCMOSFromLayout(context, context->frameIndex++, binnedImage, layout, truth);
+    STATS_END_CALL(context);
+}
+
+typedef struct BatchJob
+{
+    SimContext *context;    // Only read by the workers
+    _Bool emccd;
+    atomLayout *layout;     // NULL if the atom locations are given directly
+    int *binnedImages;
+    double *truths;
+    const double (*potentialAtomLocations)[2];
+    unsigned short cameraCoords;
+    unsigned int potentialAtomCount;
+    unsigned int approximationSteps;
+    unsigned int frameCount;
+    uint64_t firstFrameIndex;
+    atomicCounter nextFrame;
+} batchJob;
+
+typedef struct BatchWorker
+{
+    batchJob *job;
+    workspace workspace;
+    frameStats stats;
+    platformThread thread;
+} batchWorker;
+
+// Frames are handed out one by one, so threads that get frames with more atoms do not hold up the others
+static THREAD_FUNCTION(runBatchWorker, argument)
+{
+    batchWorker *worker = argument;
+    batchJob *job = worker->job;
+
+    // Private copy that shares the prepared read-only caches but uses its own workspace
+    SimContext context = *job->context;
+    context.workspace = worker->workspace;
+    STATS_BEGIN_CALL(&context);
+
+    int binnedImageSize = (context.settings.resolutionY / context.settings.binning) * (context.settings.resolutionX / context.settings.binning);
+    unsigned int truthSize = job->layout ? job->layout->siteCount : job->potentialAtomCount;
+    long frame;
+    while((frame = atomicFetchIncrement(&job->nextFrame)) < (long)job->frameCount)
+    {
+        int *binnedImage = job->binnedImages + frame * binnedImageSize;
+        double *truth = job->truths ? job->truths + frame * truthSize : NULL;
+        uint64_t frameIndex = job->firstFrameIndex + frame;
+        if(job->layout)
+        {
+            if(job->emccd)
+            {
+                createFrameEMCCDFromLayout(&context, frameIndex, binnedImage, job->layout, truth);
+            }
+            else
+            {
+                createFrameCMOSFromLayout(&context, frameIndex, binnedImage, job->layout, truth);
+            }
+        }
+        else
+        {
+            if(job->emccd)
+            {
+                createFrameEMCCD(&context, frameIndex, binnedImage, job->potentialAtomLocations, job->cameraCoords, truth, job->potentialAtomCount, job->approximationSteps);
+            }
+            else
+            {
+                createFrameCMOS(&context, frameIndex, binnedImage, job->potentialAtomLocations, job->cameraCoords, truth, job->potentialAtomCount, job->approximationSteps);
+            }
         }
     }
 
-    free(image);
-    free(atomLocations);
-    free(normalizedAtomLocations);
-    free(columnNoises);
+    // Buffers might have grown
+    worker->workspace = context.workspace;
+    worker->stats = context.lastFrameStats;
+    THREAD_RETURN;
 }
+
+/*
+ * Frame f of a batch is written to binnedImages + f * binned image size and truths + f * site count
+ * and equals the image of sequential calls, since its random streams only depend on the seed and frame index
+ */
+static void runBatch(batchJob *job)
+{
+    SimContext *context = job->context;
+    int threadCount = getBatchThreadCount(context);
+    if(threadCount > (int)job->frameCount)
+    {
+        threadCount = job->frameCount;
+    }
+    // Without frames the stats of the last call are kept as well
+    if(threadCount < 1)
+    {
+        return;
+    }
+
+    if(job->layout)
+    {
+        updateAtomLayout(context, job->layout);
+    }
+    else
+    {
+        opticsGrid grid = getOpticsGrid(context, job->approximationSteps);
+        prepareOptics(context, grid.height, grid.width, context->settings.pixelSize / job->approximationSteps);
+    }
+
+    STATS_BEGIN_CALL(context);
+
+    // The calling thread works on the batch as well, using the workspace of the context
+    workspace *threadWorkspaces = reserveThreadWorkspaces(context, threadCount - 1);
+    batchWorker *workers = malloc(threadCount * sizeof(batchWorker));
+    job->firstFrameIndex = context->frameIndex;
+    job->nextFrame = 0;
+    for(int t = 0; t < threadCount; t++)
+    {
+        workers[t].job = job;
+        workers[t].workspace = t == 0 ? context->workspace : threadWorkspaces[t - 1];
+    }
+    for(int t = 1; t < threadCount; t++)
+    {
+        startThread(&workers[t].thread, runBatchWorker, &workers[t]);
+    }
+    runBatchWorker(&workers[0]);
+    for(int t = 1; t < threadCount; t++)
+    {
+        joinThread(workers[t].thread);
+    }
+    context->workspace = workers[0].workspace;
+    for(int t = 1; t < threadCount; t++)
+    {
+        threadWorkspaces[t - 1] = workers[t].workspace;
+    }
+#ifdef NAIS_STATS
+    for(int t = 0; t < threadCount; t++)
+    {
+        addFrameStats(&context->lastFrameStats, &workers[t].stats);
+    }
+    STATS_END_CALL(context);
+#endif
+    free(workers);
+
+    context->frameIndex += job->frameCount;
+}
+
+void createImagesEMCCDBatchCtx(SimContext *context, int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount)
+{
+    batchJob job = {.context = context, .emccd = 1, .binnedImages = binnedImages, .truths = truths, .potentialAtomLocations = potentialAtomLocations, 
+        .cameraCoords = cameraCoords, .potentialAtomCount = potentialAtomCount, .approximationSteps = approximationSteps, .frameCount = frameCount};
+    runBatch(&job);
+}
+
+void createImagesCMOSBatchCtx(SimContext *context, int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount)
+{
+    batchJob job = {.context = context, .emccd = 0, .binnedImages = binnedImages, .truths = truths, .potentialAtomLocations = potentialAtomLocations, 
+        .cameraCoords = cameraCoords, .potentialAtomCount = potentialAtomCount, .approximationSteps = approximationSteps, .frameCount = frameCount};
+    runBatch(&job);
+}
+
+void createImagesEMCCDFromLayoutBatchCtx(SimContext *context, int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount)
+{
+    batchJob job = {.context = context, .emccd = 1, .layout = layout, .binnedImages = binnedImages, .truths = truths, .frameCount = frameCount};
+    runBatch(&job);
+}
+
+void createImagesCMOSFromLayoutBatchCtx(SimContext *context, int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount)
+{
+    batchJob job = {.context = context, .emccd = 0, .layout = layout, .binnedImages = binnedImages, .truths = truths, .frameCount = frameCount};
+    runBatch(&job);
+}
+
+void createImageEMCCD(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    createImageEMCCDCtx(getDefaultSimContext(), binnedImage, potentialAtomLocations, cameraCoords, truth, potentialAtomCount, approximationSteps);
+}
+
+void createImageCMOS(int *binnedImage, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truth, unsigned int potentialAtomCount, unsigned int approximationSteps)
+{
+    createImageCMOSCtx(getDefaultSimContext(), binnedImage, potentialAtomLocations, cameraCoords, truth, potentialAtomCount, approximationSteps);
+}
+
+void createImageEMCCDFromLayout(int *binnedImage, atomLayout *layout, double *truth)
+{
+    createImageEMCCDFromLayoutCtx(getDefaultSimContext(), binnedImage, layout, truth);
+}
+
+void createImageCMOSFromLayout(int *binnedImage, atomLayout *layout, double *truth)
+{
+    createImageCMOSFromLayoutCtx(getDefaultSimContext(), binnedImage, layout, truth);
+}
+
+void createImagesEMCCDBatch(int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount)
+{
+    createImagesEMCCDBatchCtx(getDefaultSimContext(), binnedImages, potentialAtomLocations, cameraCoords, truths, potentialAtomCount, approximationSteps, frameCount);
+}
+
+void createImagesCMOSBatch(int *binnedImages, const double potentialAtomLocations[][2], unsigned short cameraCoords, double *truths, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int frameCount)
+{
+    createImagesCMOSBatchCtx(getDefaultSimContext(), binnedImages, potentialAtomLocations, cameraCoords, truths, potentialAtomCount, approximationSteps, frameCount);
+}
+
+void createImagesEMCCDFromLayoutBatch(int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount)
+{
+    createImagesEMCCDFromLayoutBatchCtx(getDefaultSimContext(), binnedImages, layout, truths, frameCount);
+}
+
+void createImagesCMOSFromLayoutBatch(int *binnedImages, atomLayout *layout, double *truths, unsigned int frameCount)
+{
+    createImagesCMOSFromLayoutBatchCtx(getDefaultSimContext(), binnedImages, layout, truths, frameCount);
+}
\ No newline at end of file
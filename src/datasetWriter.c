@@ -0,0 +1,308 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "datasetWriter.h"
+#include "createSampleImage.h"
+#include "platformFiles.h"
+
+#define NPY_HEADER_SIZE 128         // Fixed so that the frame count can be rewritten in place
+#define DATASET_CHUNK_FRAMES 256    // Frames generated between two updates of the stored frame count
+
+/*
+ * Frames and truths are stored as .npy arrays of shape (frames, height, width) with int32 values and (frames, truthLength) with float64 values
+ * The files are preallocated for the capacity and memory-mapped, so the generator writes into them without copies
+ * Their headers only count the committed frames, so files of interrupted runs can be loaded by numpy and appended to
+ */
+struct DatasetWriter
+{
+    mappedFile images;
+    mappedFile truths;
+    _Bool hasTruths;
+    int frameHeight;
+    int frameWidth;
+    unsigned int truthLength;
+    uint64_t frameCount;
+    uint64_t capacity;
+};
+
+static uint64_t getImageBytes(const datasetWriter *dataset)
+{
+    return (uint64_t)dataset->frameHeight * dataset->frameWidth * sizeof(int);
+}
+
+static uint64_t getTruthBytes(const datasetWriter *dataset)
+{
+    return (uint64_t)dataset->truthLength * sizeof(double);
+}
+
+static void writeNpyHeader(unsigned char *data, const char *descriptor, const char *shape)
+{
+    memcpy(data, "\x93NUMPY\x01\x00", 8);
+    data[8] = (NPY_HEADER_SIZE - 10) & 0xff;
+    data[9] = (NPY_HEADER_SIZE - 10) >> 8;
+    char *header = (char *)data + 10;
+    int length = snprintf(header, NPY_HEADER_SIZE - 10, "{'descr': '%s', 'fortran_order': False, 'shape': (%s), }", descriptor, shape);
+    memset(header + length, ' ', NPY_HEADER_SIZE - 11 - length);
+    header[NPY_HEADER_SIZE - 11] = '\n';
+}
+
+// Only headers as written by writeNpyHeader are accepted, returns the number of values after the frame count that were read from the shape
+static int readNpyHeader(const mappedFile *file, const char *descriptor, uint64_t *frameCount, unsigned int *dimensions)
+{
+    char header[NPY_HEADER_SIZE - 9];
+    if(file->size < NPY_HEADER_SIZE || memcmp(file->data, "\x93NUMPY\x01\x00", 8) || file->data[8] != NPY_HEADER_SIZE - 10 || file->data[9])
+    {
+        return -1;
+    }
+    memcpy(header, file->data + 10, NPY_HEADER_SIZE - 10);
+    header[NPY_HEADER_SIZE - 10] = 0;
+
+    char expectedDescriptor[32];
+    snprintf(expectedDescriptor, sizeof(expectedDescriptor), "'descr': '%s'", descriptor);
+    const char *shape = strstr(header, "'shape': (");
+    if(!strstr(header, expectedDescriptor) || !shape)
+    {
+        return -1;
+    }
+    int count = sscanf(shape, "'shape': (%" SCNu64 ", %u, %u", frameCount, &dimensions[0], &dimensions[1]);
+    return count - 1;
+}
+
+static void writeHeaders(datasetWriter *dataset)
+{
+    char shape[64];
+    if(dataset->hasTruths)
+    {
+        snprintf(shape, sizeof(shape), "%" PRIu64 ", %u", dataset->frameCount, dataset->truthLength);
+        writeNpyHeader(dataset->truths.data, "<f8", shape);
+    }
+    snprintf(shape, sizeof(shape), "%" PRIu64 ", %d, %d", dataset->frameCount, dataset->frameHeight, dataset->frameWidth);
+    writeNpyHeader(dataset->images.data, "<i4", shape);
+}
+
+static int resizeDataset(datasetWriter *dataset, uint64_t capacity)
+{
+    if(!resizeMappedFile(&dataset->images, NPY_HEADER_SIZE + capacity * getImageBytes(dataset)))
+    {
+        return 0;
+    }
+    if(dataset->hasTruths && !resizeMappedFile(&dataset->truths, NPY_HEADER_SIZE + capacity * getTruthBytes(dataset)))
+    {
+        return 0;
+    }
+    dataset->capacity = capacity;
+    writeHeaders(dataset);
+    return 1;
+}
+
+// Counts the frames of an existing file, returns 0 if it holds something else
+static int openExistingFile(datasetWriter *dataset, const mappedFile *file, const char *descriptor, const unsigned int *dimensions, int dimensionCount, uint64_t frameBytes)
+{
+    uint64_t frameCount;
+    unsigned int storedDimensions[2];
+    if(readNpyHeader(file, descriptor, &frameCount, storedDimensions) != dimensionCount ||
+        memcmp(storedDimensions, dimensions, dimensionCount * sizeof(unsigned int)))
+    {
+        return 0;
+    }
+    uint64_t capacity = (file->size - NPY_HEADER_SIZE) / frameBytes;
+    if(frameCount > capacity)
+    {
+        return 0;
+    }
+    // Frames are only complete if both files count them
+    if(frameCount < dataset->frameCount)
+    {
+        dataset->frameCount = frameCount;
+    }
+    if(capacity < dataset->capacity)
+    {
+        dataset->capacity = capacity;
+    }
+    return 1;
+}
+
+/*
+ * Creates the files or continues existing ones of the same frame and truth shape after their last committed frame
+ * truthPath may be NULL if no truths are stored, capacity is the number of frames the files are preallocated for
+ */
+datasetWriter *openDataset(const char *imagePath, const char *truthPath, int frameHeight, int frameWidth, unsigned int truthLength, uint64_t capacity)
+{
+    datasetWriter *dataset = calloc(1, sizeof(datasetWriter));
+    if(!dataset)
+    {
+        return NULL;
+    }
+    dataset->frameHeight = frameHeight;
+    dataset->frameWidth = frameWidth;
+    dataset->truthLength = truthLength;
+
+    int success = openMappedFile(&dataset->images, imagePath);
+    if(success && truthPath && truthLength > 0)
+    {
+        dataset->hasTruths = 1;
+        success = openMappedFile(&dataset->truths, truthPath);
+    }
+
+    if(success && dataset->images.size > 0)
+    {
+        dataset->frameCount = UINT64_MAX;
+        dataset->capacity = UINT64_MAX;
+        unsigned int imageDimensions[2] = {frameHeight, frameWidth};
+        success = openExistingFile(dataset, &dataset->images, "<i4", imageDimensions, 2, getImageBytes(dataset)) &&
+            (!dataset->hasTruths || openExistingFile(dataset, &dataset->truths, "<f8", &truthLength, 1, getTruthBytes(dataset)));
+        success = success && (capacity <= dataset->capacity || resizeDataset(dataset, capacity));
+    }
+    else if(success)
+    {
+        success = resizeDataset(dataset, capacity);
+    }
+
+    if(!success)
+    {
+        closeDataset(dataset);
+        return NULL;
+    }
+    writeHeaders(dataset);
+    return dataset;
+}
+
+void closeDataset(datasetWriter *dataset)
+{
+    if(!dataset)
+    {
+        return;
+    }
+    closeMappedFile(&dataset->images);
+    if(dataset->hasTruths)
+    {
+        closeMappedFile(&dataset->truths);
+    }
+    free(dataset);
+}
+
+uint64_t getDatasetFrameCount(const datasetWriter *dataset)
+{
+    return dataset->frameCount;
+}
+
+/*
+ * Returns where the next frameCount frames go, growing the files if necessary, and their truths via truths unless it is NULL
+ * The frames only count as written after commitDatasetFrames
+ */
+int *reserveDatasetFrames(datasetWriter *dataset, uint64_t frameCount, double **truths)
+{
+    if(dataset->frameCount + frameCount > dataset->capacity && !resizeDataset(dataset, dataset->frameCount + frameCount))
+    {
+        return NULL;
+    }
+    if(truths)
+    {
+        *truths = dataset->hasTruths ? (double *)(dataset->truths.data + NPY_HEADER_SIZE + dataset->frameCount * getTruthBytes(dataset)) : NULL;
+    }
+    return (int *)(dataset->images.data + NPY_HEADER_SIZE + dataset->frameCount * getImageBytes(dataset));
+}
+
+void commitDatasetFrames(datasetWriter *dataset, uint64_t frameCount)
+{
+    dataset->frameCount += frameCount;
+    writeHeaders(dataset);
+    flushMappedFile(&dataset->images);
+    if(dataset->hasTruths)
+    {
+        flushMappedFile(&dataset->truths);
+    }
+}
+
+/*
+ * Generates the frames in batches straight into the files, committing them chunk by chunk
+ * As for the batch functions, the frames continue from the frame index of the context
+ */
+static int appendDataset(SimContext *context, datasetWriter *dataset, _Bool emccd, atomLayout *layout, const double potentialAtomLocations[][2],
+    unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount)
+{
+    unsigned int truthLength = layout ? layout->siteCount : potentialAtomCount;
+    if(dataset->frameHeight != context->settings.resolutionY / context->settings.binning ||
+        dataset->frameWidth != context->settings.resolutionX / context->settings.binning ||
+        (dataset->hasTruths && dataset->truthLength != truthLength))
+    {
+        return 0;
+    }
+    if(!reserveDatasetFrames(dataset, frameCount, NULL))
+    {
+        return 0;
+    }
+
+    while(frameCount > 0)
+    {
+        unsigned int chunkFrames = frameCount < DATASET_CHUNK_FRAMES ? frameCount : DATASET_CHUNK_FRAMES;
+        double *truths;
+        int *images = reserveDatasetFrames(dataset, chunkFrames, &truths);
+        if(layout)
+        {
+            if(emccd)
+            {
+                createImagesEMCCDFromLayoutBatchCtx(context, images, layout, truths, chunkFrames);
+            }
+            else
+            {
+                createImagesCMOSFromLayoutBatchCtx(context, images, layout, truths, chunkFrames);
+            }
+        }
+        else
+        {
+            if(emccd)
+            {
+                createImagesEMCCDBatchCtx(context, images, potentialAtomLocations, cameraCoords, truths, potentialAtomCount, approximationSteps, chunkFrames);
+            }
+            else
+            {
+                createImagesCMOSBatchCtx(context, images, potentialAtomLocations, cameraCoords, truths, potentialAtomCount, approximationSteps, chunkFrames);
+            }
+        }
+        commitDatasetFrames(dataset, chunkFrames);
+        frameCount -= chunkFrames;
+    }
+    return 1;
+}
+
+int appendDatasetEMCCDCtx(SimContext *context, datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount)
+{
+    return appendDataset(context, dataset, 1, NULL, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, frameCount);
+}
+
+int appendDatasetCMOSCtx(SimContext *context, datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount)
+{
+    return appendDataset(context, dataset, 0, NULL, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, frameCount);
+}
+
+int appendDatasetEMCCDFromLayoutCtx(SimContext *context, datasetWriter *dataset, atomLayout *layout, uint64_t frameCount)
+{
+    return appendDataset(context, dataset, 1, layout, NULL, 0, 0, 0, frameCount);
+}
+
+int appendDatasetCMOSFromLayoutCtx(SimContext *context, datasetWriter *dataset, atomLayout *layout, uint64_t frameCount)
+{
+    return appendDataset(context, dataset, 0, layout, NULL, 0, 0, 0, frameCount);
+}
+
+int appendDatasetEMCCD(datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount)
+{
+    return appendDatasetEMCCDCtx(getDefaultSimContext(), dataset, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, frameCount);
+}
+
+int appendDatasetCMOS(datasetWriter *dataset, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, uint64_t frameCount)
+{
+    return appendDatasetCMOSCtx(getDefaultSimContext(), dataset, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, frameCount);
+}
+
+int appendDatasetEMCCDFromLayout(datasetWriter *dataset, atomLayout *layout, uint64_t frameCount)
+{
+    return appendDatasetEMCCDFromLayoutCtx(getDefaultSimContext(), dataset, layout, frameCount);
+}
+
+int appendDatasetCMOSFromLayout(datasetWriter *dataset, atomLayout *layout, uint64_t frameCount)
+{
+    return appendDatasetCMOSFromLayoutCtx(getDefaultSimContext(), dataset, layout, frameCount);
+}
\ No newline at end of file
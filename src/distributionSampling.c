@@ -2,41 +2,247 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include "distributionSampling.h"
+#include "platformThreads.h"
 
-double randomZeroToOne()
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for(int round = 0; round < 10; round++)
+    {
+        uint64_t product0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t product1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)product1;
+        c2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)product0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+}
+
+/*
+ * Counter layout: word 0 counts the blocks drawn from the stream, word 1 holds the index,
+ * word 2 and the lower 24 bits of word 3 the frame index and the upper 8 bits of word 3 the domain
+ */
+void initRandomStream(randomStream *random, uint64_t seed, uint64_t frameIndex, randomDomain domain, uint32_t index)
+{
+    random->key[0] = (uint32_t)seed;
+    random->key[1] = (uint32_t)(seed >> 32);
+    random->counter[0] = 0;
+    random->counter[1] = index;
+    random->counter[2] = (uint32_t)frameIndex;
+    random->counter[3] = ((uint32_t)(frameIndex >> 32) & 0xFFFFFFu) | ((uint32_t)domain << 24);
+    random->buffered = 0;
+}
+
+static uint64_t nextRandom(randomStream *random)
+{
+    if(!random->buffered)
+    {
+        uint32_t output[4];
+        philox4x32(random->counter, random->key, output);
+        random->counter[0]++;
+        random->buffer[0] = output[0] | (uint64_t)output[1] << 32;
+        random->buffer[1] = output[2] | (uint64_t)output[3] << 32;
+        random->buffered = 2;
+    }
+    return random->buffer[2 - random->buffered--];
+}
+
+// Uniform in (0, 1) with 53 bits of resolution
+double randomZeroToOne(randomStream *random)
+{
+    return ((nextRandom(random) >> 11) + 0.5) * (1. / 9007199254740992.);
+}
+
+/*
+ * Bulk generation of the following blocks of a stream, identical to repeated calls of nextRandom
+ * The rounds run over all lanes at once, so the compiler can keep one block per vector lane
+ */
+#define RANDOM_FILL_BLOCKS 32
+
+SIMD_TARGET_CLONES
+static void generateBlocks(randomStream *random, uint64_t output[2 * RANDOM_FILL_BLOCKS])
+{
+    uint32_t c0[RANDOM_FILL_BLOCKS], c1[RANDOM_FILL_BLOCKS], c2[RANDOM_FILL_BLOCKS], c3[RANDOM_FILL_BLOCKS];
+    for(int lane = 0; lane < RANDOM_FILL_BLOCKS; lane++)
+    {
+        c0[lane] = random->counter[0] + lane;
+        c1[lane] = random->counter[1];
+        c2[lane] = random->counter[2];
+        c3[lane] = random->counter[3];
+    }
+    uint32_t k0 = random->key[0], k1 = random->key[1];
+    for(int round = 0; round < 10; round++)
+    {
+        for(int lane = 0; lane < RANDOM_FILL_BLOCKS; lane++)
+        {
+            uint64_t product0 = (uint64_t)PHILOX_M0 * c0[lane];
+            uint64_t product1 = (uint64_t)PHILOX_M1 * c2[lane];
+            uint32_t next0 = (uint32_t)(product1 >> 32) ^ c1[lane] ^ k0;
+            uint32_t next2 = (uint32_t)(product0 >> 32) ^ c3[lane] ^ k1;
+            c1[lane] = (uint32_t)product1;
+            c3[lane] = (uint32_t)product0;
+            c0[lane] = next0;
+            c2[lane] = next2;
+        }
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    for(int lane = 0; lane < RANDOM_FILL_BLOCKS; lane++)
+    {
+        output[2 * lane] = c0[lane] | (uint64_t)c1[lane] << 32;
+        output[2 * lane + 1] = c2[lane] | (uint64_t)c3[lane] << 32;
+    }
+    random->counter[0] += RANDOM_FILL_BLOCKS;
+}
+
+// Same values as count calls of randomZeroToOne
+void fillUniform(randomStream *random, double *values, int count)
+{
+    int i = 0;
+    while(random->buffered && i < count)
+    {
+        values[i++] = randomZeroToOne(random);
+    }
+    uint64_t bits[2 * RANDOM_FILL_BLOCKS];
+    for(; i + 2 * RANDOM_FILL_BLOCKS <= count; i += 2 * RANDOM_FILL_BLOCKS)
+    {
+        generateBlocks(random, bits);
+        for(int j = 0; j < 2 * RANDOM_FILL_BLOCKS; j++)
+        {
+            values[i + j] = ((bits[j] >> 11) + 0.5) * (1. / 9007199254740992.);
+        }
+    }
+    for(; i < count; i++)
+    {
+        values[i] = randomZeroToOne(random);
+    }
+}
+
+// Box-Muller pairs, both the cosine and the sine branch are used
+void fillGaussian(randomStream *random, double *values, int count, double mean, double stdev)
 {
-    static _Bool wasExecuted = 0;
-    if (!wasExecuted)
+    double uniforms[2 * RANDOM_FILL_BLOCKS];
+    double gaussians[2 * RANDOM_FILL_BLOCKS];
+    for(int i = 0; i < count; i += 2 * RANDOM_FILL_BLOCKS)
     {
-        time_t t;
-        srand((unsigned) time(&t));
-        wasExecuted = 1;
+        int chunk = count - i < 2 * RANDOM_FILL_BLOCKS ? count - i : 2 * RANDOM_FILL_BLOCKS;
+        int pairs = (chunk + 1) / 2;
+        fillUniform(random, uniforms, 2 * pairs);
+        #pragma omp simd
+        for(int p = 0; p < pairs; p++)
+        {
+            double radius = sqrt(-2 * log(uniforms[2 * p])) * stdev;
+            double angle = 2 * M_PI * uniforms[2 * p + 1];
+            gaussians[2 * p] = radius * cos(angle) + mean;
+            gaussians[2 * p + 1] = radius * sin(angle) + mean;
+        }
+        memcpy(values + i, gaussians, chunk * sizeof(double));
+    }
+}
+
+void fillGumbel(randomStream *random, double *values, int count, double location, double scale)
+{
+    fillUniform(random, values, count);
+    #pragma omp simd
+    for(int i = 0; i < count; i++)
+    {
+        values[i] = location - scale * log(-log(values[i]));
     }
-    return rand() / (double)RAND_MAX;
 }
 
-double sampleGaussian(double mean, double stdev)
+double sampleGaussian(randomStream *random, double mean, double stdev)
 {
-    double boxMullerMethod = sqrt(-2 * log(randomZeroToOne())) * cos(2 * M_PI * randomZeroToOne());
+    double boxMullerMethod = sqrt(-2 * log(randomZeroToOne(random))) * cos(2 * M_PI * randomZeroToOne(random));
     return boxMullerMethod * stdev + mean;
 }
 
-int samplePoisson(double lambda)
+static const double logFactorialTable[10] = {0., 0., 0.6931471805599453, 1.791759469228055, 3.1780538303479458, 
+    4.787491742782046, 6.579251212010101, 8.525161361065415, 10.60460290274525, 12.801827480081469};
+
+// log(k!) from the table or Stirling's series, which is accurate to double precision for k >= 10
+static double logFactorial(int k)
 {
-    double l = pow(M_E, -lambda);
-    int k = 0;
-    double p = 1;
-    while(p > l)
+    if(k < 10)
     {
-        k++;
-        p = p * randomZeroToOne();
+        return logFactorialTable[k];
+    }
+    double inverse = 1. / k;
+    double inverseSq = inverse * inverse;
+    return (k + 0.5) * log(k) - k + 0.91893853320467274178 + inverse * (1. / 12. - inverseSq * (1. / 360. - inverseSq / 1260.));
+}
+
+/*
+ * Inversion by sequential search for small lambda, one uniform and about lambda multiplications per sample
+ * Transformed rejection with squeeze (PTRS) for large lambda, constant expected cost
+ * https://doi.org/10.1016/0167-6687(93)90997-4
+ */
+int samplePoisson(randomStream *random, double lambda)
+{
+    if(lambda <= 0)
+    {
+        return 0;
+    }
+    else if(lambda < 10)
+    {
+        double u = randomZeroToOne(random);
+        double p = exp(-lambda);
+        double cdf = p;
+        int k = 0;
+        // The bound guards against rounding of the cdf below u
+        while(u > cdf && k < 100)
+        {
+            k++;
+            p *= lambda / k;
+            cdf += p;
+        }
+        return k;
+    }
+    else
+    {
+        double sqrtLambda = sqrt(lambda);
+        double logLambda = log(lambda);
+        double b = 0.931 + 2.53 * sqrtLambda;
+        double a = -0.059 + 0.02483 * b;
+        double logInverseAlpha = log(1.1239 + 1.1328 / (b - 3.4));
+        double vR = 0.9277 - 3.6224 / (b - 2);
+        while(1)
+        {
+            double u = randomZeroToOne(random) - 0.5;
+            double v = randomZeroToOne(random);
+            double us = 0.5 - fabs(u);
+            double k = floor((2 * a / us + b) * u + lambda + 0.43);
+            if(us >= 0.07 && v <= vR)
+            {
+                return k;
+            }
+            if(k < 0 || (us < 0.013 && v > us))
+            {
+                continue;
+            }
+            if(log(v) + logInverseAlpha - log(a / (us * us) + b) <= -lambda + k * logLambda - logFactorial(k))
+            {
+                return k;
+            }
+        }
     }
-    return k - 1;
 }
 
 // Marsaglia's transformation-rejection method
-double marsagliaGamma(double shape) 
+static double marsagliaGamma(randomStream *random, double shape) 
 {
     double x,v,u;
     double d = shape - 1./3.; 
@@ -47,11 +253,11 @@ double marsagliaGamma(double shape)
     	v = 0;
         while(v <= 0) 
         {
-            x = sampleGaussian(0,1);
+            x = sampleGaussian(random, 0, 1);
             v = 1. + c * x;
         }
         v = v*v*v; 
-        u = randomZeroToOne();
+        u = randomZeroToOne(random);
         double xSq = x * x;
         if(u < 1. - 0.0331 * xSq * xSq) 
         {
@@ -64,23 +270,104 @@ double marsagliaGamma(double shape)
     }
 }
 
-double sampleGamma(double shape, double rate)
+double sampleGamma(randomStream *random, double shape, double rate)
 {
     double val;
     if(shape < 1)
     {
-        val = marsagliaGamma(shape + 1) * pow(randomZeroToOne(), 1 / shape);
+        val = marsagliaGamma(random, shape + 1) * pow(randomZeroToOne(random), 1 / shape);
     }
     else
     {
-        val = marsagliaGamma(shape);
+        val = marsagliaGamma(random, shape);
     }
     return val / rate;
 }
 
-double sampleGumbel(double location, double scale)
+double sampleGumbel(randomStream *random, double location, double scale)
 {
-    return location - scale * log(-log(randomZeroToOne()));
+    return location - scale * log(-log(randomZeroToOne(random)));
+}
+
+static double solveEMGainQuantile(int primary, double rand, double tolerance)
+{
+    // fOverDerivFac = sampledGain^(1-primary) * (a-1)!
+    long double fOverDerivFac = M_E;
+    for(double i = 1; i < primary; i++)
+    {
+        fOverDerivFac *= i / primary * M_E;
+    }
+
+    double sampledGain = primary;
+    double diff = 1;
+    while(diff > tolerance)
+    {
+        double sum = 1; // j = primary - 1 => summand = 1 already added
+        double summand = 1;
+        for(int j = primary - 1; j > 0; j--)
+        {
+            summand *= j / sampledGain;
+            sum += summand;
+        }
+        // Factor after fOverDeriv changes sampledGain^(1-primary) to the new sampledGain
+        double fOverDeriv = fOverDerivFac * pow(primary / sampledGain, primary - 1) * rand * pow(M_E, sampledGain - primary);
+        fOverDeriv -= sum;
+        double secondDerivOverDeriv = (primary - 1) / sampledGain - 1;
+
+        double change = fOverDeriv * (1 + fOverDeriv * secondDerivOverDeriv / 2);
+        sampledGain -= change;
+        diff = change * change;
+    }
+    return sampledGain;
+}
+
+/*
+ * The quantiles b = n/g do not depend on the gain, so one table per primary count serves every gain setting
+ * Each table holds b and db/du at equidistant u, in between cubic Hermite interpolation is used
+ * Close to u = 0 and u = 1 the quantile function is too steep for the table, there the root is solved for directly
+ */
+#define EM_GAIN_TABLE_MAX_PRIMARY 16
+#define EM_GAIN_TABLE_INTERVALS 1024
+#define EM_GAIN_TABLE_MARGIN 16
+
+static double emGainTables[EM_GAIN_TABLE_MAX_PRIMARY - 1][EM_GAIN_TABLE_INTERVALS + 1][2];
+static platformOnce emGainTablesOnce = PLATFORM_ONCE_INITIALIZER;
+
+static void buildEMGainTables()
+{
+    for(int primary = 2; primary <= EM_GAIN_TABLE_MAX_PRIMARY; primary++)
+    {
+        double (*table)[2] = emGainTables[primary - 2];
+        double logNormalization = lgamma(primary);
+        for(int i = EM_GAIN_TABLE_MARGIN; i <= EM_GAIN_TABLE_INTERVALS - EM_GAIN_TABLE_MARGIN; i++)
+        {
+            double b = solveEMGainQuantile(primary, (double)i / EM_GAIN_TABLE_INTERVALS, 1e-26);
+            double density = exp((primary - 1) * log(b) - b - logNormalization);
+            table[i][0] = b;
+            table[i][1] = 1. / density;
+        }
+        // The sign of the derivative follows the orientation of the quantile function
+        if(table[EM_GAIN_TABLE_MARGIN][0] > table[EM_GAIN_TABLE_INTERVALS - EM_GAIN_TABLE_MARGIN][0])
+        {
+            for(int i = EM_GAIN_TABLE_MARGIN; i <= EM_GAIN_TABLE_INTERVALS - EM_GAIN_TABLE_MARGIN; i++)
+            {
+                table[i][1] = -table[i][1];
+            }
+        }
+    }
+}
+
+static double interpolateEMGainTable(int primary, double rand)
+{
+    const double (*table)[2] = (const double (*)[2])emGainTables[primary - 2];
+    double position = rand * EM_GAIN_TABLE_INTERVALS;
+    int i = position;
+    double t = position - i;
+    double h = 1. / EM_GAIN_TABLE_INTERVALS;
+    double tSq = t * t;
+    double tCube = tSq * t;
+    return (2 * tCube - 3 * tSq + 1) * table[i][0] + (tCube - 2 * tSq + t) * h * table[i][1] + 
+        (-2 * tCube + 3 * tSq) * table[i + 1][0] + (tCube - tSq) * h * table[i + 1][1];
 }
 
 /* 
@@ -101,8 +388,10 @@ double sampleGumbel(double location, double scale)
  * 
  * https://doi.org/10.1145/22721.23109
  * https://doi.org/10.1016/S0960-0779(00)00259-9
+ *
+ * The roots for small x are tabulated, large x are sampled as Gamma(x, g) with Marsaglia's method
  */
-int sampleEMGain(int primary, double emGain)
+int sampleEMGain(randomStream *random, int primary, double emGain)
 {
     if(primary == 0)
     {
@@ -110,44 +399,26 @@ int sampleEMGain(int primary, double emGain)
     }
     else if(primary == 1)
     {
-        return -emGain * log(randomZeroToOne());
+        return -emGain * log(randomZeroToOne(random));
     }
-    else
+    else if(primary <= EM_GAIN_TABLE_MAX_PRIMARY)
     {
-        // fOverDerivFac = sampledGain^(1-primary) * (a-1)!
-        long double fOverDerivFac = M_E;
-        for(double i = 1; i < primary; i++)
+        runOnce(&emGainTablesOnce, buildEMGainTables);
+        double rand = randomZeroToOne(random);
+        double position = rand * EM_GAIN_TABLE_INTERVALS;
+        if(position < EM_GAIN_TABLE_MARGIN || position >= EM_GAIN_TABLE_INTERVALS - EM_GAIN_TABLE_MARGIN)
         {
-            fOverDerivFac *= i / primary * M_E;
+            return solveEMGainQuantile(primary, rand, 1. / (100 * emGain * emGain)) * emGain;
         }
-
-        double sampledGain = primary;
-        double rand = randomZeroToOne();
-        double diff = 1;
-        while(diff > 1. / (100 * emGain * emGain))
-        {
-            double sum = 1; // j = primary - 1 => summand = 1 already added
-            double summand = 1;
-            for(int j = primary - 1; j > 0; j--)
-            {
-                summand *= j / sampledGain;
-                sum += summand;
-            }
-            // Factor after fOverDeriv changes sampledGain^(1-primary) to the new sampledGain
-            double fOverDeriv = fOverDerivFac * pow(primary / sampledGain, primary - 1) * rand * pow(M_E, sampledGain - primary);
-            fOverDeriv -= sum;
-            double secondDerivOverDeriv = (primary - 1) / sampledGain - 1;
-
-            double change = fOverDeriv * (1 + fOverDeriv * secondDerivOverDeriv / 2);
-            sampledGain -= change;
-            diff = change * change;
-        }
-
-        return sampledGain * emGain;
+        return interpolateEMGainTable(primary, rand) * emGain;
+    }
+    else
+    {
+        return marsagliaGamma(random, primary) * emGain;
     }
 }
 
-double sampleTimeOfAtomLossImaging(double survivalProbability)
+double sampleTimeOfAtomLossImaging(randomStream *random, double survivalProbability)
 {
-    return log((survivalProbability - 1) * randomZeroToOne() + 1) / log(survivalProbability);
-}
+    return log((survivalProbability - 1) * randomZeroToOne(random) + 1) / log(survivalProbability);
+}
\ No newline at end of file
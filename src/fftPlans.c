@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include "fftPlans.h"
+#include "platformThreads.h"
+
+typedef struct FFTPlanEntry
+{
+    fftPlanKind kind;
+    int height;
+    int width;
+    unsigned int rigor;
+    fftPlan plan;
+    struct FFTPlanEntry *next;
+} fftPlanEntry;
+
+// Plans are created once per shape and executed on the caller's buffers using the new-array execute functions.
+// All buffers handed to them must therefore be allocated by fftw_alloc_* to have the same alignment as the planning buffers.
+static fftPlanEntry *fftPlans = NULL;
+static unsigned int planningRigor = FFTW_MEASURE;
+// Executing plans is thread-safe, but the registry and the FFTW planner are shared by all contexts
+// Plans are never destroyed, other threads may still execute a plan they looked up before, so at most one plan per shape and rigor is kept
+static platformMutex fftPlansMutex = PLATFORM_MUTEX_INITIALIZER;
+
+fftPlan getFFTPlan(fftPlanKind kind, int height, int width)
+{
+    lockMutex(&fftPlansMutex);
+    for(fftPlanEntry *entry = fftPlans; entry; entry = entry->next)
+    {
+        if(entry->kind == kind && entry->height == height && entry->width == width && entry->rigor == planningRigor)
+        {
+            unlockMutex(&fftPlansMutex);
+            return entry->plan;
+        }
+    }
+
+    // Planning with anything but FFTW_ESTIMATE overwrites the buffers, so separate ones are used here
+    fftPlan plan;
+    if(kind == FFT_REAL_TO_COMPLEX || kind == FFT_COMPLEX_TO_REAL)
+    {
+        real *realBuffer = FFTW(alloc_real)(height * width);
+        fftComplex *halfSpectrum = FFTW(alloc_complex)(height * (width / 2 + 1));
+        if(kind == FFT_REAL_TO_COMPLEX)
+        {
+            plan = FFTW(plan_dft_r2c_2d)(height, width, realBuffer, halfSpectrum, planningRigor);
+        }
+        else
+        {
+            plan = FFTW(plan_dft_c2r_2d)(height, width, halfSpectrum, realBuffer, planningRigor);
+        }
+        FFTW(free)(realBuffer);
+        FFTW(free)(halfSpectrum);
+    }
+    else
+    {
+        fftComplex *in = FFTW(alloc_complex)(height * width);
+        fftComplex *out = FFTW(alloc_complex)(height * width);
+        plan = FFTW(plan_dft_2d)(height, width, in, out, kind == FFT_FORWARD ? FFTW_FORWARD : FFTW_BACKWARD, planningRigor);
+        FFTW(free)(in);
+        FFTW(free)(out);
+    }
+
+    // Without memory for the entry the plan is still usable, it just is not cached and planned again next time
+    fftPlanEntry *entry = malloc(sizeof(fftPlanEntry));
+    if(!entry)
+    {
+        unlockMutex(&fftPlansMutex);
+        return plan;
+    }
+    entry->kind = kind;
+    entry->height = height;
+    entry->width = width;
+    entry->rigor = planningRigor;
+    entry->plan = plan;
+    entry->next = fftPlans;
+    fftPlans = entry;
+    unlockMutex(&fftPlansMutex);
+    return plan;
+}
+
+// Smallest size of at least minimumSize without prime factors above 7, FFTW has hard-coded kernels for these
+int getFFTFriendlySize(int minimumSize)
+{
+    for(int size = minimumSize > 1 ? minimumSize : 1;; size++)
+    {
+        int remainder = size;
+        const int factors[4] = {2, 3, 5, 7};
+        for(int f = 0; f < 4; f++)
+        {
+            while(remainder % factors[f] == 0)
+            {
+                remainder /= factors[f];
+            }
+        }
+        if(remainder == 1)
+        {
+            return size;
+        }
+    }
+}
+
+void setFFTPlanningRigor(int level)
+{
+    // 0: FFTW_ESTIMATE, 1: FFTW_MEASURE, 2: FFTW_PATIENT, 3: FFTW_EXHAUSTIVE
+    const unsigned int rigorFlags[4] = {FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT, FFTW_EXHAUSTIVE};
+    if(level < 0 || level > 3)
+    {
+        return;
+    }
+    // Plans of the previous rigor stay registered for threads still executing them, they are just no longer handed out
+    lockMutex(&fftPlansMutex);
+    planningRigor = rigorFlags[level];
+    unlockMutex(&fftPlansMutex);
+}
+
+int exportWisdom(const char *path)
+{
+    lockMutex(&fftPlansMutex);
+    int success = FFTW(export_wisdom_to_filename)(path);
+    unlockMutex(&fftPlansMutex);
+    return success;
+}
+
+int importWisdom(const char *path)
+{
+    lockMutex(&fftPlansMutex);
+    int success = FFTW(import_wisdom_from_filename)(path);
+    unlockMutex(&fftPlansMutex);
+    return success;
+}
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frameProducer.h"
+#include "createSampleImage.h"
+#include "platformThreads.h"
+
+/*
+ * A background thread generates batches of consecutive frames into a ring of depth preallocated slots, ahead of the consumer
+ * It simulates on copies of the context and the layout, so the frames start at the frame index the context had at creation
+ * and later changes to the context or updates of the layout do not affect them. The batches themselves are generated by threadCount threads
+ */
+struct FrameProducer
+{
+    SimContext *context;
+    _Bool emccd;
+    atomLayout *layout;     // Own copy, NULL if the atom locations are given directly
+    double (*potentialAtomLocations)[2];
+    unsigned short cameraCoords;
+    unsigned int potentialAtomCount;
+    unsigned int approximationSteps;
+    unsigned int batchSize;
+    int depth;
+    size_t imageBatchSize;
+    size_t truthBatchSize;
+    int *images;
+    double *truths;
+    uint64_t *firstFrameIndices;
+
+    // Slot of batch b is b % depth, the batches from consumedBatches to producedBatches are ready
+    uint64_t producedBatches;
+    uint64_t consumedBatches;
+    _Bool stopping;
+    platformMutex mutex;
+    platformCondition condition;
+    platformThread thread;
+};
+
+static void produceBatch(frameProducer *producer, int slot)
+{
+    int *images = producer->images + slot * producer->imageBatchSize;
+    double *truths = producer->truthBatchSize ? producer->truths + slot * producer->truthBatchSize : NULL;
+    producer->firstFrameIndices[slot] = producer->context->frameIndex;
+    if(producer->layout)
+    {
+        if(producer->emccd)
+        {
+            createImagesEMCCDFromLayoutBatchCtx(producer->context, images, producer->layout, truths, producer->batchSize);
+        }
+        else
+        {
+            createImagesCMOSFromLayoutBatchCtx(producer->context, images, producer->layout, truths, producer->batchSize);
+        }
+    }
+    else
+    {
+        if(producer->emccd)
+        {
+            createImagesEMCCDBatchCtx(producer->context, images, (const double (*)[2])producer->potentialAtomLocations, producer->cameraCoords, truths,
+                producer->potentialAtomCount, producer->approximationSteps, producer->batchSize);
+        }
+        else
+        {
+            createImagesCMOSBatchCtx(producer->context, images, (const double (*)[2])producer->potentialAtomLocations, producer->cameraCoords, truths,
+                producer->potentialAtomCount, producer->approximationSteps, producer->batchSize);
+        }
+    }
+}
+
+static THREAD_FUNCTION(runFrameProducer, argument)
+{
+    frameProducer *producer = argument;
+    lockMutex(&producer->mutex);
+    while(1)
+    {
+        while(!producer->stopping && producer->producedBatches - producer->consumedBatches >= (uint64_t)producer->depth)
+        {
+            waitCondition(&producer->condition, &producer->mutex);
+        }
+        if(producer->stopping)
+        {
+            break;
+        }
+        int slot = producer->producedBatches % producer->depth;
+        unlockMutex(&producer->mutex);
+
+        produceBatch(producer, slot);
+
+        lockMutex(&producer->mutex);
+        producer->producedBatches++;
+        broadcastCondition(&producer->condition);
+    }
+    unlockMutex(&producer->mutex);
+    THREAD_RETURN;
+}
+
+// Everything but the thread and its synchronization, also used to clean up a producer that could not be created completely
+static void freeProducerBuffers(frameProducer *producer)
+{
+    freeSimContext(producer->context);
+    freeAtomLayout(producer->layout);
+    free(producer->potentialAtomLocations);
+    free(producer->images);
+    free(producer->truths);
+    free(producer->firstFrameIndices);
+    free(producer);
+}
+
+static frameProducer *createFrameProducer(const SimContext *context, _Bool emccd, atomLayout *layout, const double potentialAtomLocations[][2],
+    unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount)
+{
+    if(batchSize < 1 || depth < 1)
+    {
+        return NULL;
+    }
+    frameProducer *producer = calloc(1, sizeof(frameProducer));
+    if(!producer)
+    {
+        return NULL;
+    }
+    producer->context = copySimContext(context);
+    producer->layout = layout ? copyAtomLayout(layout) : NULL;
+    producer->emccd = emccd;
+    producer->cameraCoords = cameraCoords;
+    producer->potentialAtomCount = potentialAtomCount;
+    producer->approximationSteps = approximationSteps;
+    _Bool copiesLocations = !layout && potentialAtomCount;
+    if(copiesLocations)
+    {
+        producer->potentialAtomLocations = malloc(potentialAtomCount * 2 * sizeof(double));
+    }
+    producer->batchSize = batchSize;
+    producer->depth = depth;
+
+    int binnedImageSize = (context->settings.resolutionY / context->settings.binning) * (context->settings.resolutionX / context->settings.binning);
+    producer->imageBatchSize = (size_t)batchSize * binnedImageSize;
+    producer->truthBatchSize = (size_t)batchSize * (layout ? layout->siteCount : potentialAtomCount);
+    producer->images = malloc(depth * producer->imageBatchSize * sizeof(int));
+    producer->truths = malloc(depth * producer->truthBatchSize * sizeof(double));
+    producer->firstFrameIndices = malloc(depth * sizeof(uint64_t));
+
+    if(!producer->context || (layout && !producer->layout) || (copiesLocations && !producer->potentialAtomLocations) || 
+        !producer->images || (producer->truthBatchSize && !producer->truths) || !producer->firstFrameIndices)
+    {
+        freeProducerBuffers(producer);
+        return NULL;
+    }
+    setThreadCountCtx(producer->context, threadCount);
+    if(copiesLocations)
+    {
+        memcpy(producer->potentialAtomLocations, potentialAtomLocations, potentialAtomCount * 2 * sizeof(double));
+    }
+
+    initMutex(&producer->mutex);
+    initCondition(&producer->condition);
+    startThread(&producer->thread, runFrameProducer, producer);
+    return producer;
+}
+
+void freeFrameProducer(frameProducer *producer)
+{
+    if(!producer)
+    {
+        return;
+    }
+    lockMutex(&producer->mutex);
+    producer->stopping = 1;
+    broadcastCondition(&producer->condition);
+    unlockMutex(&producer->mutex);
+    joinThread(producer->thread);
+
+    destroyCondition(&producer->condition);
+    destroyMutex(&producer->mutex);
+    freeProducerBuffers(producer);
+}
+
+/*
+ * Waits for the next batch and returns its batchSize consecutive binned images, its truths via truths and the index of its first frame via firstFrameIndex
+ * The batch stays valid until releaseFrameBatch, which has to be called before acquiring the next one
+ */
+int *acquireFrameBatch(frameProducer *producer, double **truths, uint64_t *firstFrameIndex)
+{
+    lockMutex(&producer->mutex);
+    while(producer->producedBatches == producer->consumedBatches)
+    {
+        waitCondition(&producer->condition, &producer->mutex);
+    }
+    int slot = producer->consumedBatches % producer->depth;
+    unlockMutex(&producer->mutex);
+
+    if(truths)
+    {
+        *truths = producer->truthBatchSize ? producer->truths + slot * producer->truthBatchSize : NULL;
+    }
+    if(firstFrameIndex)
+    {
+        *firstFrameIndex = producer->firstFrameIndices[slot];
+    }
+    return producer->images + slot * producer->imageBatchSize;
+}
+
+void releaseFrameBatch(frameProducer *producer)
+{
+    lockMutex(&producer->mutex);
+    producer->consumedBatches++;
+    broadcastCondition(&producer->condition);
+    unlockMutex(&producer->mutex);
+}
+
+frameProducer *createFrameProducerEMCCDCtx(const SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducer(context, 1, NULL, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerCMOSCtx(const SimContext *context, const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducer(context, 0, NULL, potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerEMCCDFromLayoutCtx(const SimContext *context, atomLayout *layout, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducer(context, 1, layout, NULL, 0, 0, 0, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerCMOSFromLayoutCtx(const SimContext *context, atomLayout *layout, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducer(context, 0, layout, NULL, 0, 0, 0, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerEMCCD(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducerEMCCDCtx(getDefaultSimContext(), potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerCMOS(const double potentialAtomLocations[][2], unsigned short cameraCoords, unsigned int potentialAtomCount, unsigned int approximationSteps, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducerCMOSCtx(getDefaultSimContext(), potentialAtomLocations, cameraCoords, potentialAtomCount, approximationSteps, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerEMCCDFromLayout(atomLayout *layout, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducerEMCCDFromLayoutCtx(getDefaultSimContext(), layout, batchSize, depth, threadCount);
+}
+
+frameProducer *createFrameProducerCMOSFromLayout(atomLayout *layout, unsigned int batchSize, int depth, int threadCount)
+{
+    return createFrameProducerCMOSFromLayoutCtx(getDefaultSimContext(), layout, batchSize, depth, threadCount);
+}
\ No newline at end of file
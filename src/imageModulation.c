@@ -1,109 +1,421 @@
-#include <complex.h>
-#include <fftw3.h>
+#define _USE_MATH_DEFINES
 #include <math.h>
-#include "settings.h"
+#include <stdlib.h>
+#include <string.h>
+#include "simContext.h"
+#include "imageModulation.h"
+#include "fftPlans.h"
+
+#define PSF_SUPPORT_RADIUS 20           // In units of wavelength / numerical aperture, the airy pattern is below 2e-6 of its peak beyond
+#define UNTRUNCATED_GAUSSIAN_SUPPORT 8  // In standard deviations, padding for light sources without cutoff
+#define POINT_SOURCE_TOLERANCE 1e-7     // Relative error of the spectrum of point sources within the band of the mtf
+#define POINT_SPREAD_AMPLIFICATION 1e3  // Largest factor dividing out the spread of point sources may amplify rounding errors by
+#define POINT_SPREAD_CUTOFF 7           // In standard deviations of the spread, its truncation stays below the tolerance at the largest amplification
+#define POINT_SPREAD_MAX_RADIUS 16      // Bound of the spread radius, the limits above keep it at 12 pixels
+#define CUBIC_SPREAD_MIN_STDEV 1        // In pixels, narrower light sources are spread like points since the cubic weights miss too much of their spectrum
+
+// Radial order and normalization of the terms of ZernikePhase
+static const int zernikeOrders[15] = {0, 1, 1, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4};
+static const double zernikeNormalizations[15] = {1, 2, 2, 1.7320508075688772, 2.4494897427831781, 2.4494897427831781, 2.8284271247461901, 2.8284271247461901, 
+    2.8284271247461901, 2.8284271247461901, 2.2360679774997897, 3.1622776601683795, 3.1622776601683795, 3.1622776601683795, 3.1622776601683795};
+
+// Zernike polynomials by Noll index at radius r of the unit pupil and angle u
+static void getZernikeTerms(double r, double u, double terms[15])
+{
+    double rSq = r * r;
+    terms[0] = 1;
+    terms[1] = 2 * r * cos(u);
+    terms[2] = 2 * r * sin(u);
+    terms[3] = sqrt(3) * (2 * rSq - 1);
+    terms[4] = sqrt(6) * rSq * sin(2*u);
+    terms[5] = sqrt(6) * rSq * cos(2*u);
+    terms[6] = sqrt(8) * (3 * rSq - 2) * r * sin(u);
+    terms[7] = sqrt(8) * (3 * rSq - 2) * r * cos(u);
+    terms[8] = sqrt(8) * rSq * r * sin(3*u);
+    terms[9] = sqrt(8) * rSq * r * cos(3*u);
+    terms[10] = sqrt(5) * (1 - 6 * rSq + 6 * rSq * rSq);
+    terms[11] = sqrt(10) * (4 * rSq - 3) * rSq * cos(2*u);
+    terms[12] = sqrt(10) * (4 * rSq - 3) * rSq * sin(2*u);
+    terms[13] = sqrt(10) * rSq * rSq * cos(4*u);
+    terms[14] = sqrt(10) * rSq * rSq * sin(4*u);
+}
 
 double ZernikePhase(double r, double u, const double zernikeCoefficients[15])
 {
+    double terms[15];
+    getZernikeTerms(r, u, terms);
     double Z = 0;
-    double rSq = r * r;
-    Z += zernikeCoefficients[0];
-    Z += zernikeCoefficients[1] * 2 * r * cos(u);
-    Z += zernikeCoefficients[2] * 2 * r * sin(u);
-    Z += zernikeCoefficients[3] * sqrt(3) * (2 * rSq - 1);
-    Z += zernikeCoefficients[4] * sqrt(6) * rSq * sin(2*u);
-    Z += zernikeCoefficients[5] * sqrt(6) * rSq * cos(2*u);
-    Z += zernikeCoefficients[6] * sqrt(8) * (3 * rSq - 2) * r * sin(u);
-    Z += zernikeCoefficients[7] * sqrt(8) * (3 * rSq - 2) * r * cos(u);
-    Z += zernikeCoefficients[8] * sqrt(8) * rSq * r * sin(3*u);
-    Z += zernikeCoefficients[9] * sqrt(8) * rSq * r * cos(3*u);
-    Z += zernikeCoefficients[10] * sqrt(5) * (1 - 6 * rSq + 6 * rSq * rSq);
-    Z += zernikeCoefficients[11] * sqrt(10) * (4 * rSq - 3) * rSq * cos(2*u);
-    Z += zernikeCoefficients[12] * sqrt(10) * (4 * rSq - 3) * rSq * sin(2*u);
-    Z += zernikeCoefficients[13] * sqrt(10) * rSq * rSq * cos(4*u);
-    Z += zernikeCoefficients[14] * sqrt(10) * rSq * rSq * sin(4*u);
+    for(int k = 0; k < 15; k++)
+    {
+        Z += zernikeCoefficients[k] * terms[k];
+    }
     return Z;
 }
 
-void simulateOptics(double *inputImage, int imageHeight, int imageWidth, double effectivePixelSize, double photonsPerAtom)
+static _Bool isZernikeBasisCached(const zernikeBasisCache *cache, int imageHeight, int imageWidth, int centerY, int centerX, double yFactor, double xFactor, double pupilRadius)
 {
-    double xFac = 1;
-    double yFac = 1;
-    int smallerDimension;
-    if(imageHeight < imageWidth)
+    return cache->valid &&
+        cache->imageHeight == imageHeight &&
+        cache->imageWidth == imageWidth &&
+        cache->centerY == centerY &&
+        cache->centerX == centerX &&
+        cache->yFactor == yFactor &&
+        cache->xFactor == xFactor &&
+        cache->pupilRadius == pupilRadius;
+}
+
+static void updateZernikeBasis(zernikeBasisCache *cache, int imageHeight, int imageWidth, int centerY, int centerX, double yFactor, double xFactor, double pupilRadius)
+{
+    if(isZernikeBasisCached(cache, imageHeight, imageWidth, centerY, centerX, yFactor, xFactor, pupilRadius))
     {
-        smallerDimension = imageHeight;
-        xFac = (double)imageHeight / imageWidth;
+        return;
     }
-    else
+
+    int pixelCount = 0;
+    for (int i = 0; i < imageHeight; i++)
     {
-        smallerDimension = imageWidth;
-        yFac = (double)imageWidth / imageHeight;
+        for(int j = 0; j < imageWidth; j++)
+        {
+            double y = (i - centerY) * yFactor;
+            double x = (j - centerX) * xFactor;
+            pixelCount += sqrt(x * x + y * y) < pupilRadius;
+        }
+    }
+    if(pixelCount > cache->pixelCapacity)
+    {
+        free(cache->pixelIndices);
+        free(cache->terms);
+        cache->pixelIndices = requireAllocation(malloc(pixelCount * sizeof(int)), pixelCount * sizeof(int));
+        cache->terms = requireAllocation(malloc(15 * (size_t)pixelCount * sizeof(double)), 15 * (size_t)pixelCount * sizeof(double));
+        cache->pixelCapacity = pixelCount;
     }
 
-    double pupilRadius = smallerDimension * effectivePixelSize * simulationSettings.numericalAperture / simulationSettings.wavelength;   // Pupil radius in pixels
-
-    // Allocating buffer memory
-    // INEFFICIENT, buffers are only used once to make code readable
-    // CHANGE FOR FINAL VERSION!
-    fftw_complex *pupil = fftw_alloc_complex(imageHeight * imageWidth);
-    fftw_complex *psf = fftw_alloc_complex(imageHeight * imageWidth);
-    fftw_complex *otf = fftw_alloc_complex(imageHeight * imageWidth);
-    double *mtf = fftw_alloc_real(imageHeight * imageWidth);
-    fftw_complex *image = fftw_alloc_complex(imageHeight * imageWidth);
-    fftw_complex *imageFT = fftw_alloc_complex(imageHeight * imageWidth);
-
-    // Construct complex pupil and apply fft to get psf
-    fftw_plan p = fftw_plan_dft_2d(imageHeight, imageWidth, pupil, psf, FFTW_FORWARD, FFTW_ESTIMATE);
+    int p = 0;
     for (int i = 0; i < imageHeight; i++)
     {
         for(int j = 0; j < imageWidth; j++)
         {
-            double y = (i - (imageHeight - 1) / 2) * yFac;
-            double x = (j - (imageHeight - 1) / 2) * xFac;
+            double y = (i - centerY) * yFactor;
+            double x = (j - centerX) * xFactor;
             double r = sqrt(x * x + y * y);
             if(r < pupilRadius)
             {
-                double theta = atan2(y, x);
-                double phase = 2 * M_PI / simulationSettings.wavelength * ZernikePhase(r / pupilRadius, theta, simulationSettings.zernikeCoefficients);
-                pupil[i * imageWidth + j] = cos(phase) + sin(phase) * I;
+                double terms[15];
+                getZernikeTerms(r / pupilRadius, atan2(y, x), terms);
+                for(int k = 0; k < 15; k++)
+                {
+                    cache->terms[k * (size_t)pixelCount + p] = terms[k];
+                }
+                cache->pixelIndices[p++] = i * imageWidth + j;
             }
-            else
+        }
+    }
+
+    cache->pixelCount = pixelCount;
+    cache->imageHeight = imageHeight;
+    cache->imageWidth = imageWidth;
+    cache->centerY = centerY;
+    cache->centerX = centerX;
+    cache->yFactor = yFactor;
+    cache->xFactor = xFactor;
+    cache->pupilRadius = pupilRadius;
+    cache->valid = 1;
+}
+
+// Phases of the pupil pixels as linear combination of the cached terms, skipping unused terms, and their cosines and sines in one vectorized pass
+SIMD_TARGET_CLONES
+static void computePupilValues(const zernikeBasisCache *cache, const double zernikeCoefficients[15], double wavenumber, double *cosines, double *sines)
+{
+    int pixelCount = cache->pixelCount;
+    double *phases = cosines;
+    memset(phases, 0, pixelCount * sizeof(double));
+    for(int k = 0; k < 15; k++)
+    {
+        double coefficient = zernikeCoefficients[k];
+        const double *terms = cache->terms + k * (size_t)pixelCount;
+        if(coefficient != 0)
+        {
+            #pragma omp simd
+            for(int p = 0; p < pixelCount; p++)
             {
-                pupil[i * imageWidth + j] = 0;
+                phases[p] += coefficient * terms[p];
             }
         }
     }
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    #pragma omp simd
+    for(int p = 0; p < pixelCount; p++)
+    {
+        double phase = wavenumber * phases[p];
+        cosines[p] = cos(phase);
+        sines[p] = sin(phase);
+    }
+}
+
+/*
+ * Complex pupil of the current aberrations on an imageHeight x imageWidth grid, pixel (i, j) lying at ((i - centerY) * yFactor, (j - centerX) * xFactor)
+ * and the pupil having a radius of pupilRadius pixels. The Zernike terms only depend on this geometry and are kept in cache
+ */
+void fillPupil(SimContext *context, zernikeBasisCache *cache, fftComplex *pupil, int imageHeight, int imageWidth, int centerY, int centerX, double yFactor, double xFactor, double pupilRadius)
+{
+    updateZernikeBasis(cache, imageHeight, imageWidth, centerY, centerX, yFactor, xFactor, pupilRadius);
+
+    double *cosines = reserveWorkspaceBuffer(&cache->pupilValues, 2 * (size_t)cache->pixelCount * sizeof(double));
+    double *sines = cosines + cache->pixelCount;
+    computePupilValues(cache, context->settings.zernikeCoefficients, 2 * M_PI / context->settings.wavelength, cosines, sines);
+
+    memset(pupil, 0, imageHeight * imageWidth * sizeof(fftComplex));
+    for(int p = 0; p < cache->pixelCount; p++)
+    {
+        pupil[cache->pixelIndices[p]] = cosines[p] + sines[p] * I;
+    }
+}
+
+void invalidateOpticalTransferFunction(SimContext *context)
+{
+    context->opticalTransferFunction.valid = 0;
+}
+
+/*
+ * Distance in camera pixels beyond which an atom adds no noticeable light: the light source gaussian up to its cutoff,
+ * the airy pattern and the geometric blur of the aberrations, bounded by the largest slope of the wavefront error
+ * Piston and tilt are left out since they only shift the psf, which the mtf does not depend on
+ */
+static double getOpticalSupportRadius(const SimContext *context)
+{
+    double cutoff = context->settings.lightSourceCutoff > 0 ? context->settings.lightSourceCutoff : UNTRUNCATED_GAUSSIAN_SUPPORT;
+    double radius = context->settings.lightSourceStdev * cutoff;
+
+    double maxWavefrontSlope = 0;
+    for(int k = 3; k < 15; k++)
+    {
+        maxWavefrontSlope += fabs(context->settings.zernikeCoefficients[k]) * zernikeNormalizations[k] * zernikeOrders[k] * zernikeOrders[k];
+    }
+    double psfRadius = (PSF_SUPPORT_RADIUS * context->settings.wavelength + maxWavefrontSlope) / context->settings.numericalAperture;
+    return radius + psfRadius / context->settings.pixelSize;
+}
+
+/*
+ * The convolution is circular, so the visible image is padded by the support radius on every side to keep light from wrapping around
+ * The padding never exceeds half of the visible size, as the previous fixed doubling, and the sizes are rounded up to fast FFT lengths
+ */
+opticsGrid getOpticsGrid(const SimContext *context, int approximationSteps)
+{
+    int imageHeight = approximationSteps * context->settings.resolutionY;
+    int imageWidth = approximationSteps * context->settings.resolutionX;
+    double supportRadius = ceil(getOpticalSupportRadius(context) * approximationSteps);
+
+    opticsGrid grid;
+    grid.height = getFFTFriendlySize(imageHeight + 2 * (int)fmin(supportRadius, (imageHeight + 1) / 2));
+    grid.width = getFFTFriendlySize(imageWidth + 2 * (int)fmin(supportRadius, (imageWidth + 1) / 2));
+    grid.offsetY = (grid.height - imageHeight) / 2;
+    grid.offsetX = (grid.width - imageWidth) / 2;
+    return grid;
+}
+
+// The mtf only depends on the optical setup and the grid, not on the atoms, so it is kept across frames
+static _Bool isOpticalTransferFunctionCached(const SimContext *context, int imageHeight, int imageWidth, double effectivePixelSize)
+{
+    const otfCache *cache = &context->opticalTransferFunction;
+    return cache->valid && 
+        cache->imageHeight == imageHeight && 
+        cache->imageWidth == imageWidth && 
+        cache->effectivePixelSize == effectivePixelSize && 
+        cache->numericalAperture == context->settings.numericalAperture && 
+        cache->wavelength == context->settings.wavelength && 
+        !memcmp(cache->zernikeCoefficients, context->settings.zernikeCoefficients, 15 * sizeof(double));
+}
+
+static void computeModulationTransferFunction(SimContext *context, real *mtf, int imageHeight, int imageWidth, double effectivePixelSize)
+{
+    double xFac = 1;
+    double yFac = 1;
+    int smallerDimension;
+    if(imageHeight < imageWidth)
+    {
+        smallerDimension = imageHeight;
+        xFac = (double)imageHeight / imageWidth;
+    }
+    else
+    {
+        smallerDimension = imageWidth;
+        yFac = (double)imageWidth / imageHeight;
+    }
+
+    double pupilRadius = smallerDimension * effectivePixelSize * context->settings.numericalAperture / context->settings.wavelength;   // Pupil radius in pixels
+
+    int halfWidth = imageWidth / 2 + 1;
+    fftComplex *pupil = FFTW(alloc_complex)(imageHeight * imageWidth);
+    fftComplex *psf = FFTW(alloc_complex)(imageHeight * imageWidth);
+    real *psfIntensity = FFTW(alloc_real)(imageHeight * imageWidth);
+    fftComplex *otf = FFTW(alloc_complex)(imageHeight * halfWidth);
+
+    // Construct complex pupil and apply fft to get psf
+    fillPupil(context, &context->mtfZernikeBasis, pupil, imageHeight, imageWidth, (imageHeight - 1) / 2, (imageHeight - 1) / 2, yFac, xFac, pupilRadius);
+    FFTW(execute_dft)(getFFTPlan(FFT_FORWARD, imageHeight, imageWidth), pupil, psf);
 
     // Finalize psf and apply fft to get otf
-    p = fftw_plan_dft_2d(imageHeight, imageWidth, psf, otf, FFTW_FORWARD, FFTW_ESTIMATE);
+    // The psf intensity is real, so only the non-redundant half of its spectrum is computed
     for (int i = 0; i < imageHeight; i++)
     {
         for(int j = 0; j < imageWidth; j++)
         {
             double abs = cabs(psf[i * imageWidth + j]);
-            psf[i * imageWidth + j] = abs * abs;
+            psfIntensity[i * imageWidth + j] = abs * abs;
         }
     }
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    FFTW(execute_dft_r2c)(getFFTPlan(FFT_REAL_TO_COMPLEX, imageHeight, imageWidth), psfIntensity, otf);
 
     // Construct mtf and apply ifftshift
     double max_val = cabs(otf[0]);
     for (int i = 0; i < imageHeight; i++)
     {
-        for(int j = 0; j < imageWidth; j++)
+        for(int j = 0; j < halfWidth; j++)
+        {
+            mtf[i * halfWidth + j] = cabs(otf[i * halfWidth + j] / max_val);
+        }
+    }
+
+    FFTW(free)(pupil);
+    FFTW(free)(psf);
+    FFTW(free)(psfIntensity);
+    FFTW(free)(otf);
+}
+
+static const real *getModulationTransferFunction(SimContext *context, int imageHeight, int imageWidth, double effectivePixelSize)
+{
+    otfCache *cache = &context->opticalTransferFunction;
+    if(!isOpticalTransferFunctionCached(context, imageHeight, imageWidth, effectivePixelSize))
+    {
+        if(cache->imageHeight * (cache->imageWidth / 2 + 1) != imageHeight * (imageWidth / 2 + 1))
+        {
+            FFTW(free)(cache->mtf);
+            cache->mtf = requireAllocation(FFTW(alloc_real)(imageHeight * (imageWidth / 2 + 1)), imageHeight * (imageWidth / 2 + 1) * sizeof(real));
+        }
+        computeModulationTransferFunction(context, cache->mtf, imageHeight, imageWidth, effectivePixelSize);
+
+        cache->imageHeight = imageHeight;
+        cache->imageWidth = imageWidth;
+        cache->effectivePixelSize = effectivePixelSize;
+        cache->numericalAperture = context->settings.numericalAperture;
+        cache->wavelength = context->settings.wavelength;
+        memcpy(cache->zernikeCoefficients, context->settings.zernikeCoefficients, 15 * sizeof(double));
+        cache->valid = 1;
+    }
+    return cache->mtf;
+}
+
+// Highest spatial frequency the mtf passes in cycles per pixel, the autocorrelation of the pupil reaches twice its radius
+static double getBandLimit(const SimContext *context, double effectivePixelSize)
+{
+    return 2 * context->settings.numericalAperture * effectivePixelSize / context->settings.wavelength;
+}
+
+/*
+ * Point sources are spread over the pixels by a gaussian that simulateOptics divides out again within the band of the mtf, which leaves the exact spectrum
+ * of points at their sub-pixel positions. The spread is chosen wide enough that its aliases within the band stay below the tolerance
+ * Returns its stdev in pixels, or 0 if the band reaches too close to the Nyquist frequency for that and point sources are rounded to pixels instead
+ */
+double getPointSourceSpread(const SimContext *context, double effectivePixelSize)
+{
+    double bandLimit = getBandLimit(context, effectivePixelSize);
+    if(bandLimit >= 0.5)
+    {
+        return 0;
+    }
+    double variance = -log(POINT_SOURCE_TOLERANCE) / (2 * M_PI * M_PI * (1 - 2 * bandLimit));
+    if(2 * M_PI * M_PI * variance * bandLimit * bandLimit > log(POINT_SPREAD_AMPLIFICATION))
+    {
+        return 0;
+    }
+    return sqrt(variance);
+}
+
+// Transfer function of the aperture of a pixel along one axis, integrating over a box of one pixel is sinc in the Fourier domain
+static double getPixelResponse(double frequency)
+{
+    return frequency == 0 ? 1 : sin(M_PI * frequency) / (M_PI * frequency);
+}
+
+/*
+ * Whether atoms without a light source stdev are placed exactly at their sub-pixel positions at these approximation steps
+ * This needs a band limit 2 NA pixelSize / (wavelength approximationSteps) below about 0.35 cycles per pixel, otherwise they are rounded to the nearest pixel
+ */
+int usesExactPointSourcesCtx(const SimContext *context, unsigned int approximationSteps)
+{
+    return approximationSteps > 0 && getPointSourceSpread(context, context->settings.pixelSize / approximationSteps) > 0;
+}
+
+int usesExactPointSources(unsigned int approximationSteps)
+{
+    return usesExactPointSourcesCtx(getDefaultSimContext(), approximationSteps);
+}
+
+// Buffers used by simulateOptics and addLightSource for images of imageHeight x imageWidth
+void reserveOpticsWorkspace(workspace *workspace, int imageHeight, int imageWidth)
+{
+    reserveWorkspaceBuffer(&workspace->fftImage, imageHeight * imageWidth * sizeof(real));
+    reserveWorkspaceBuffer(&workspace->spectrum, imageHeight * (imageWidth / 2 + 1) * sizeof(fftComplex));
+    reserveWorkspaceBuffer(&workspace->lightSourceFactors, (imageHeight + imageWidth / 2 + 1) * sizeof(double));
+}
+
+// Fill the caches simulateOptics needs, afterwards copies of the context can simulate concurrently without writing to them
+void prepareOptics(SimContext *context, int imageHeight, int imageWidth, double effectivePixelSize)
+{
+    getModulationTransferFunction(context, imageHeight, imageWidth, effectivePixelSize);
+    getFFTPlan(FFT_REAL_TO_COMPLEX, imageHeight, imageWidth);
+    getFFTPlan(FFT_COMPLEX_TO_REAL, imageHeight, imageWidth);
+}
+
+// lightSourceStdev is in pixels of the image, the gaussian blur of the light sources is applied together with the mtf
+// Below CUBIC_SPREAD_MIN_STDEV the spread of point sources by addLightSource is divided out, in the band of the mtf, beyond it the mtf is zero anyway
+// With pixelIntegration the sinc response of the pixel aperture is applied as well, so each pixel holds the integral over its area instead of the value at its center
+void simulateOptics(SimContext *context, real *inputImage, int imageHeight, int imageWidth, double effectivePixelSize, double lightSourceStdev, double photonsPerAtom)
+{
+    STATS_START_TIMER(start);
+    const real *mtf = getModulationTransferFunction(context, imageHeight, imageWidth, effectivePixelSize);
+
+    // Both the image and the mtf are real, so real-to-complex transforms on half spectra suffice
+    int halfWidth = imageWidth / 2 + 1;
+    reserveOpticsWorkspace(&context->workspace, imageHeight, imageWidth);
+    real *image = context->workspace.fftImage.data;
+    fftComplex *imageFT = context->workspace.spectrum.data;
+
+    // The gaussian is separable and its transfer function analytic, one factor per row and one per column of the half spectrum
+    double *rowFactors = context->workspace.lightSourceFactors.data;
+    double *columnFactors = rowFactors + imageHeight;
+    double gaussianExponent = -2 * M_PI * M_PI * lightSourceStdev * lightSourceStdev;
+    double maxFrequency = 1;
+    double pointSpread = lightSourceStdev < CUBIC_SPREAD_MIN_STDEV ? getPointSourceSpread(context, effectivePixelSize) : 0;
+    if(pointSpread > 0)
+    {
+        gaussianExponent = 2 * M_PI * M_PI * (pointSpread * pointSpread - lightSourceStdev * lightSourceStdev);
+        maxFrequency = getBandLimit(context, effectivePixelSize) + 2. / fmin(imageHeight, imageWidth);   // Margin for the pixels of the pupil edge
+    }
+    for(int i = 0; i < imageHeight; i++)
+    {
+        double frequency = fmin(fabs((double)(i <= imageHeight / 2 ? i : i - imageHeight) / imageHeight), maxFrequency);
+        rowFactors[i] = exp(gaussianExponent * frequency * frequency);
+    }
+    for(int j = 0; j < halfWidth; j++)
+    {
+        double frequency = fmin((double)j / imageWidth, maxFrequency);
+        columnFactors[j] = exp(gaussianExponent * frequency * frequency);
+    }
+    if(context->settings.pixelIntegration)
+    {
+        for(int i = 0; i < imageHeight; i++)
         {
-            mtf[i * imageWidth + j] = cabs(otf[i * imageWidth + j] / max_val);
+            rowFactors[i] *= getPixelResponse((double)(i <= imageHeight / 2 ? i : i - imageHeight) / imageHeight);
+        }
+        for(int j = 0; j < halfWidth; j++)
+        {
+            columnFactors[j] *= getPixelResponse((double)j / imageWidth);
         }
     }
 
     // Construct test input and apply fft
     // In this case single illuminated pixels at approximate atom location
     double sumInitial = 0;
-    p = fftw_plan_dft_2d(imageHeight, imageWidth, image, imageFT, FFTW_FORWARD, FFTW_ESTIMATE);
     for (int i = 0; i < imageHeight; i++)
     {
         for(int j = 0; j < imageWidth; j++)
@@ -112,27 +424,28 @@ void simulateOptics(double *inputImage, int imageHeight, int imageWidth, double
             sumInitial += inputImage[i * imageWidth + j];
         }
     }
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    STATS_START_TIMER(forwardStart);
+    FFTW(execute_dft_r2c)(getFFTPlan(FFT_REAL_TO_COMPLEX, imageHeight, imageWidth), image, imageFT);
+    STATS_ADD_TIME(context, fftSeconds, forwardStart);
     
-    // Multiply fft of image with mtf and apply ifft to get final image
-    p = fftw_plan_dft_2d(imageHeight, imageWidth, imageFT, image, FFTW_BACKWARD, FFTW_ESTIMATE);
+    // Multiply fft of image with mtf and light source transfer function and apply ifft to get final image
     for (int i = 0; i < imageHeight; i++)
     {
-        for(int j = 0; j < imageWidth; j++)
+        for(int j = 0; j < halfWidth; j++)
         {
-            imageFT[i * imageWidth + j] = mtf[i * imageWidth + j] * imageFT[i * imageWidth + j];
+            imageFT[i * halfWidth + j] = (real)(mtf[i * halfWidth + j] * rowFactors[i] * columnFactors[j]) * imageFT[i * halfWidth + j];
         }
     }
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    STATS_START_TIMER(inverseStart);
+    FFTW(execute_dft_c2r)(getFFTPlan(FFT_COMPLEX_TO_REAL, imageHeight, imageWidth), imageFT, image);
+    STATS_ADD_TIME(context, fftSeconds, inverseStart);
 
     double sumEnd = 0;
     for (int i = 0; i < imageHeight; i++)
     {
         for(int j = 0; j < imageWidth; j++)
         {
-            inputImage[i * imageWidth + j] = cabs(image[i * imageWidth + j]) / (imageHeight * imageWidth);
+            inputImage[i * imageWidth + j] = fabs(image[i * imageWidth + j]) / (imageHeight * imageWidth);
             sumEnd += inputImage[i * imageWidth + j];
         }
     }
@@ -144,11 +457,79 @@ void simulateOptics(double *inputImage, int imageHeight, int imageWidth, double
             inputImage[i * imageWidth + j] = inputImage[i * imageWidth + j] / sumEnd * sumInitial * photonsPerAtom;
         }
     }
+    STATS_ADD_TIME(context, opticsSeconds, start);
+}
+
+double getPhotonsPerAtom(const SimContext *context)
+{
+    double fractionalSolidAngle = (1 - sqrt(1 - context->settings.numericalAperture * context->settings.numericalAperture)) / 2;
+    return fractionalSolidAngle * context->settings.scatteringRate * context->settings.exposureTime * context->settings.quantumEfficiency;
+}
 
-    fftw_free(pupil);
-    fftw_free(psf);
-    fftw_free(otf);
-    fftw_free(mtf);
-    fftw_free(image);
-    fftw_free(imageFT);
+// Weights of the pixels at offsets -1 to 2 from the one left of a point at fraction t, cubic Lagrange interpolation in reverse
+static void getCubicSpreadWeights(double t, double weights[4])
+{
+    weights[0] = -t * (t - 1) * (t - 2) / 6;
+    weights[1] = (t + 1) * (t - 1) * (t - 2) / 2;
+    weights[2] = -(t + 1) * t * (t - 2) / 2;
+    weights[3] = (t + 1) * t * (t - 1) / 6;
+}
+
+// Samples of a normalized gaussian of stdev spread around a point, truncated after POINT_SPREAD_CUTOFF stdevs
+static void spreadPointSource(real *image, int imageHeight, int imageWidth, double x, double y, double brightness, double spread)
+{
+    int radius = fmin(ceil(POINT_SPREAD_CUTOFF * spread), POINT_SPREAD_MAX_RADIUS);
+    int xCenter = round(x);
+    int yCenter = round(y);
+    double columnFactors[2 * POINT_SPREAD_MAX_RADIUS + 1];
+    for(int l = -radius; l <= radius; l++)
+    {
+        columnFactors[l + radius] = exp(-(xCenter + l - x) * (xCenter + l - x) / (2 * spread * spread));
+    }
+    double normalization = brightness / (2 * M_PI * spread * spread);
+    for(int k = -radius; k <= radius; k++)
+    {
+        double rowFactor = normalization * exp(-(yCenter + k - y) * (yCenter + k - y) / (2 * spread * spread));
+        real *imageRow = image + (((yCenter + k) % imageHeight + imageHeight) % imageHeight) * imageWidth;
+        for(int l = -radius; l <= radius; l++)
+        {
+            imageRow[((xCenter + l) % imageWidth + imageWidth) % imageWidth] += rowFactor * columnFactors[l + radius];
+        }
+    }
+}
+
+/*
+ * Adds an atom as a point at x, y in pixels counted from the center of the first one, the gaussian of its light source is applied by simulateOptics in the Fourier domain
+ * Light sources narrower than CUBIC_SPREAD_MIN_STDEV pixels are spread by pointSpread from getPointSourceSpread, which simulateOptics divides out again,
+ * leaving the exact spectrum of the point. Wider ones, and narrow ones if pointSpread is 0, are spread over the 4 x 4 pixels around their position
+ * with weights that keep the first three moments of the point. Their spectrum deviates by the fourth order, which the blur damps to about 1e-2 of the peak
+ * at a stdev of one pixel and 3e-3 at two for a point between pixels under the default optics. Point sources without either are rounded to the nearest pixel. The convolution is circular, so the spread wraps around as well
+ */
+void addLightSource(real *image, int imageHeight, int imageWidth, double x, double y, double brightness, double stdev, double pointSpread)
+{
+    if(pointSpread > 0 && stdev < CUBIC_SPREAD_MIN_STDEV)
+    {
+        spreadPointSource(image, imageHeight, imageWidth, x, y, brightness, pointSpread);
+    }
+    else if(stdev > 0)
+    {
+        int xLeft = floor(x);
+        int yTop = floor(y);
+        double columnWeights[4];
+        double rowWeights[4];
+        getCubicSpreadWeights(x - xLeft, columnWeights);
+        getCubicSpreadWeights(y - yTop, rowWeights);
+        for(int k = 0; k < 4; k++)
+        {
+            real *imageRow = image + ((yTop - 1 + k + imageHeight) % imageHeight) * imageWidth;
+            for(int l = 0; l < 4; l++)
+            {
+                imageRow[(xLeft - 1 + l + imageWidth) % imageWidth] += brightness * rowWeights[k] * columnWeights[l];
+            }
+        }
+    }
+    else
+    {
+        image[(((int)round(y) % imageHeight + imageHeight) % imageHeight) * imageWidth + ((int)round(x) % imageWidth + imageWidth) % imageWidth] += brightness;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "settings.h"
+#include "simContext.h"
+#include "atomLayout.h"
+#include "datasetWriter.h"
+
+/*
+ * Command-line tool that writes one shard of a dataset of frames as .npy files
+ * Frame i of the dataset only depends on the settings, the sites, the seed and i, so shards can be generated by independent processes
+ * and their concatenation in shard order equals the dataset generated at once
+ * The files are checkpointed by the dataset writer, so running the same command again continues after the last committed frame
+ */
+typedef struct Options
+{
+    const char *configPath;
+    const char *layoutPath;
+    const char *outputPrefix;
+    uint64_t frameCount;
+    uint64_t shardIndex;
+    uint64_t shardCount;
+    uint64_t seed;
+    _Bool emccd;
+    unsigned short cameraCoords;
+    unsigned int approximationSteps;
+    int threadCount;
+    _Bool noTruths;
+} options;
+
+static void printUsage(FILE *stream)
+{
+    fprintf(stream,
+        "Usage: naisim --layout FILE --frames N --output PREFIX [options]\n"
+        "  --config FILE              Settings to use, default simulationSettings.cfg\n"
+        "  --layout FILE              Potential atom sites, one \"x y\" pair per line, '#' starts a comment\n"
+        "                             By default normalized to the field of view, [0, 1) from the first to past the last pixel\n"
+        "  --micrometers              Sites are given in micrometres in the object plane instead, divided by the field of view\n"
+        "  --camera-coords            Sites are normalized to the field of view, the default\n"
+        "  --frames N                 Number of frames of the whole dataset\n"
+        "  --shard-index I            Shard written by this process, default 0\n"
+        "  --shard-count K            Number of shards the dataset is split into, default 1\n"
+        "  --seed S                   Base seed of the dataset, default 0\n"
+        "  --camera emccd|cmos        Simulated camera, default emccd\n"
+        "  --approximation-steps N    Subdivisions of each pixel for the optical simulation, default 1\n"
+        "  --threads N                Threads to use, default 0 for all processors\n"
+        "  --no-truths                Do not store the occupations of the sites\n"
+        "  --output PREFIX            Writes PREFIX_images.npy and PREFIX_truths.npy, with _shardI inserted if K > 1\n");
+}
+
+static int parseUnsigned(const char *text, uint64_t *value)
+{
+    char *end;
+    if(!text || *text == '-')
+    {
+        return 0;
+    }
+    *value = strtoull(text, &end, 0);
+    return end != text && !*end;
+}
+
+static int parseOptions(int argc, char **argv, options *options)
+{
+    memset(options, 0, sizeof(*options));
+    options->configPath = "simulationSettings.cfg";
+    options->shardCount = 1;
+    options->emccd = 1;
+    options->approximationSteps = 1;
+    options->cameraCoords = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char *name = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        uint64_t number;
+        if(!strcmp(name, "--camera-coords"))
+        {
+            options->cameraCoords = 1;
+            continue;
+        }
+        if(!strcmp(name, "--micrometers"))
+        {
+            options->cameraCoords = 0;
+            continue;
+        }
+        if(!strcmp(name, "--no-truths"))
+        {
+            options->noTruths = 1;
+            continue;
+        }
+        if(!value)
+        {
+            fprintf(stderr, "Missing value of %s\n", name);
+            return 0;
+        }
+        i++;
+
+        if(!strcmp(name, "--config"))
+        {
+            options->configPath = value;
+        }
+        else if(!strcmp(name, "--layout"))
+        {
+            options->layoutPath = value;
+        }
+        else if(!strcmp(name, "--output"))
+        {
+            options->outputPrefix = value;
+        }
+        else if(!strcmp(name, "--camera") && (!strcmp(value, "emccd") || !strcmp(value, "cmos")))
+        {
+            options->emccd = !strcmp(value, "emccd");
+        }
+        else if(!strcmp(name, "--frames") && parseUnsigned(value, &number))
+        {
+            options->frameCount = number;
+        }
+        else if(!strcmp(name, "--shard-index") && parseUnsigned(value, &number))
+        {
+            options->shardIndex = number;
+        }
+        else if(!strcmp(name, "--shard-count") && parseUnsigned(value, &number))
+        {
+            options->shardCount = number;
+        }
+        else if(!strcmp(name, "--seed") && parseUnsigned(value, &number))
+        {
+            options->seed = number;
+        }
+        else if(!strcmp(name, "--approximation-steps") && parseUnsigned(value, &number) && number > 0 && number <= 64)
+        {
+            options->approximationSteps = number;
+        }
+        else if(!strcmp(name, "--threads") && parseUnsigned(value, &number) && number <= 4096)
+        {
+            options->threadCount = number;
+        }
+        else
+        {
+            fprintf(stderr, "Invalid option %s %s\n", name, value);
+            return 0;
+        }
+    }
+
+    if(!options->layoutPath || !options->outputPrefix || !options->frameCount)
+    {
+        fprintf(stderr, "--layout, --frames and --output are required\n");
+        return 0;
+    }
+    if(!options->shardCount || options->shardIndex >= options->shardCount)
+    {
+        fprintf(stderr, "--shard-index has to be smaller than --shard-count\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the sites of the file and their count via siteCount, or NULL if the file could not be read
+static double (*readLayout(const char *path, unsigned int *siteCount))[2]
+{
+    FILE *file = fopen(path, "r");
+    if(!file)
+    {
+        return NULL;
+    }
+    unsigned int capacity = 64;
+    double (*sites)[2] = malloc(capacity * sizeof(*sites));
+    *siteCount = 0;
+
+    char line[1024];
+    int lineNumber = 0;
+    while(fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if(comment)
+        {
+            *comment = 0;
+        }
+        double x, y;
+        char rest;
+        int count = sscanf(line, " %lf%*[ ,\t]%lf %c", &x, &y, &rest);
+        if(count == EOF)
+        {
+            continue;
+        }
+        if(count != 2)
+        {
+            fprintf(stderr, "%s:%d: expected a pair of coordinates\n", path, lineNumber);
+            free(sites);
+            fclose(file);
+            return NULL;
+        }
+        if(*siteCount == capacity)
+        {
+            capacity *= 2;
+            sites = realloc(sites, capacity * sizeof(*sites));
+        }
+        sites[*siteCount][0] = x;
+        sites[*siteCount][1] = y;
+        (*siteCount)++;
+    }
+    fclose(file);
+    return sites;
+}
+
+int main(int argc, char **argv)
+{
+    options options;
+    if(argc < 2 || !strcmp(argv[1], "--help"))
+    {
+        printUsage(argc < 2 ? stderr : stdout);
+        return argc < 2;
+    }
+    if(!parseOptions(argc, argv, &options))
+    {
+        printUsage(stderr);
+        return 1;
+    }
+
+    unsigned int siteCount;
+    double (*sites)[2] = readLayout(options.layoutPath, &siteCount);
+    if(!sites)
+    {
+        fprintf(stderr, "Could not read the layout %s\n", options.layoutPath);
+        return 1;
+    }
+
+    SimContext *context = createSimContext();
+    if(!context)
+    {
+        fprintf(stderr, "Could not create the simulation context\n");
+        free(sites);
+        return 1;
+    }
+    if(!readConfigCtx(context, options.configPath))
+    {
+        fprintf(stderr, "Could not open the settings %s\n", options.configPath);
+        freeSimContext(context);
+        free(sites);
+        return 1;
+    }
+    setSeedCtx(context, options.seed);
+    setThreadCountCtx(context, options.threadCount);
+
+    // Contiguous ranges of frames, so the shards only differ by at most one frame in size
+    uint64_t firstFrame = options.frameCount / options.shardCount * options.shardIndex +
+        (options.shardIndex < options.frameCount % options.shardCount ? options.shardIndex : options.frameCount % options.shardCount);
+    uint64_t shardFrames = options.frameCount / options.shardCount + (options.shardIndex < options.frameCount % options.shardCount);
+
+    size_t pathLength = strlen(options.outputPrefix) + 64;
+    char *imagePath = malloc(pathLength);
+    char *truthPath = malloc(pathLength);
+    if(options.shardCount > 1)
+    {
+        snprintf(imagePath, pathLength, "%s_shard%" PRIu64 "_images.npy", options.outputPrefix, options.shardIndex);
+        snprintf(truthPath, pathLength, "%s_shard%" PRIu64 "_truths.npy", options.outputPrefix, options.shardIndex);
+    }
+    else
+    {
+        snprintf(imagePath, pathLength, "%s_images.npy", options.outputPrefix);
+        snprintf(truthPath, pathLength, "%s_truths.npy", options.outputPrefix);
+    }
+
+    int frameHeight = context->settings.resolutionY / context->settings.binning;
+    int frameWidth = context->settings.resolutionX / context->settings.binning;
+    datasetWriter *dataset = openDataset(imagePath, options.noTruths ? NULL : truthPath, frameHeight, frameWidth, siteCount, shardFrames);
+    int status = 1;
+    if(!dataset)
+    {
+        fprintf(stderr, "Could not open %s, existing files have to be of the same frame size and site count\n", imagePath);
+    }
+    else if(getDatasetFrameCount(dataset) > shardFrames)
+    {
+        fprintf(stderr, "%s already holds %" PRIu64 " frames, more than the %" PRIu64 " of this shard\n", imagePath, getDatasetFrameCount(dataset), shardFrames);
+    }
+    else
+    {
+        uint64_t writtenFrames = getDatasetFrameCount(dataset);
+        if(writtenFrames > 0)
+        {
+            fprintf(stderr, "Continuing after frame %" PRIu64 " of %" PRIu64 "\n", writtenFrames, shardFrames);
+        }
+        // The layout is computed once for all frames, which also keeps it identical between restarts
+        atomLayout *layout = prepareAtomLayoutCtx(context, (const double (*)[2])sites, options.cameraCoords, siteCount, options.approximationSteps);
+        setFrameIndexCtx(context, firstFrame + writtenFrames);
+        int success = layout && (options.emccd ? appendDatasetEMCCDFromLayoutCtx(context, dataset, layout, shardFrames - writtenFrames) :
+            appendDatasetCMOSFromLayoutCtx(context, dataset, layout, shardFrames - writtenFrames));
+        if(!layout)
+        {
+            fprintf(stderr, "Could not prepare the layout %s\n", options.layoutPath);
+        }
+        else if(success)
+        {
+            printf("Wrote frames %" PRIu64 " to %" PRIu64 " of the dataset to %s\n", firstFrame, firstFrame + shardFrames, imagePath);
+            status = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Could not write to %s\n", imagePath);
+        }
+        freeAtomLayout(layout);
+    }
+
+    closeDataset(dataset);
+    freeSimContext(context);
+    free(sites);
+    free(imagePath);
+    free(truthPath);
+    return status;
+}
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include "settings.h"
+#include "simContext.h"
+#include "imageModulation.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-settings simulationSettings = {
+const settings defaultSettings = {
     .strayLightRate = 0.4,
     .darkCurrentRate = 0.00029,
     .darkCurrentSamplingAlpha = 0.006,
@@ -30,17 +32,20 @@ settings simulationSettings = {
     .survivalProbability = 1,
     .fillingRatio = 1,
     .lightSourceStdev = 0,
+    .lightSourceCutoff = 6,
+    .pixelIntegration = 0,
     .binning = 1,
     .resolutionX = 512,
     .resolutionY = 512,
 };
 
-EXPORT void readConfig(const char *path)
+// Returns 0 if the file could not be opened, the settings are left unchanged then
+int readConfigCtx(SimContext *context, const char *path)
 {
     FILE *file = fopen(path, "r");
     if(!file)
     {
-        return;
+        return 0;
     }
     char line[1024];
     while(fgets(line, 1023, file))
@@ -59,141 +64,151 @@ EXPORT void readConfig(const char *path)
         if(!strcmp(name, "strayLightRate"))
         {
             double valueC = atof(value);
-            simulationSettings.strayLightRate = valueC;
+            context->settings.strayLightRate = valueC;
         }
         else if(!strcmp(name, "darkCurrentRate"))
         {
             double valueC = atof(value);
-            simulationSettings.darkCurrentRate = valueC;
+            context->settings.darkCurrentRate = valueC;
         }
         else if(!strcmp(name, "darkCurrentSamplingAlpha"))
         {
             double valueC = atof(value);
-            simulationSettings.darkCurrentSamplingAlpha = valueC;
+            context->settings.darkCurrentSamplingAlpha = valueC;
         }
         else if(!strcmp(name, "darkCurrentSamplingBeta"))
         {
             double valueC = atof(value);
-            simulationSettings.darkCurrentSamplingBeta = valueC;
+            context->settings.darkCurrentSamplingBeta = valueC;
         }
         else if(!strcmp(name, "cicChance"))
         {
             double valueC = atof(value);
-            simulationSettings.cicChance = valueC;
+            context->settings.cicChance = valueC;
         }
         else if(!strcmp(name, "quantumEfficiency"))
         {
             double valueC = atof(value);
-            simulationSettings.quantumEfficiency = valueC;
+            context->settings.quantumEfficiency = valueC;
         }
         else if(!strcmp(name, "wavelength"))
         {
             double valueC = atof(value);
-            simulationSettings.wavelength = valueC;
+            context->settings.wavelength = valueC;
         }
         else if(!strcmp(name, "numericalAperture"))
         {
             double valueC = atof(value);
-            simulationSettings.numericalAperture = valueC;
+            context->settings.numericalAperture = valueC;
         }
         else if(!strcmp(name, "physicalPixelSize"))
         {
             double valueC = atof(value);
-            simulationSettings.physicalPixelSize = valueC;
-            simulationSettings.pixelSize = valueC / simulationSettings.magnification;
+            context->settings.physicalPixelSize = valueC;
+            context->settings.pixelSize = valueC / context->settings.magnification;
         }
         else if(!strcmp(name, "magnification"))
         {
             double valueC = atof(value);
-            simulationSettings.magnification = valueC;
-            simulationSettings.pixelSize = simulationSettings.physicalPixelSize / valueC;
+            context->settings.magnification = valueC;
+            context->settings.pixelSize = context->settings.physicalPixelSize / valueC;
         }
         else if(!strcmp(name, "biasClamp"))
         {
             double valueC = atof(value);
-            simulationSettings.biasClamp = valueC;
+            context->settings.biasClamp = valueC;
         }
         else if(!strcmp(name, "biasStdev"))
         {
             double valueC = atof(value);
-            simulationSettings.biasStdev = valueC;
+            context->settings.biasStdev = valueC;
         }
         else if(!strcmp(name, "rowNoiseStdev"))
         {
             double valueC = atof(value);
-            simulationSettings.rowNoiseStdev = valueC;
+            context->settings.rowNoiseStdev = valueC;
         }
         else if(!strcmp(name, "columnNoiseScale"))
         {
             double valueC = atof(value);
-            simulationSettings.columnNoiseScale = valueC;
+            context->settings.columnNoiseScale = valueC;
         }
         else if(!strcmp(name, "flickerNoiseScale"))
         {
             double valueC = atof(value);
-            simulationSettings.flickerNoiseScale = valueC;
+            context->settings.flickerNoiseScale = valueC;
         }
         else if(!strcmp(name, "preampgain"))
         {
             double valueC = atof(value);
-            simulationSettings.preampgain = valueC;
+            context->settings.preampgain = valueC;
         }
         else if(!strcmp(name, "sCICChance"))
         {
             double valueC = atof(value);
-            simulationSettings.sCICChance = valueC;
+            context->settings.sCICChance = valueC;
         }
         else if(!strcmp(name, "readoutStdev"))
         {
             double valueC = atof(value);
-            simulationSettings.readoutStdev = valueC;
+            context->settings.readoutStdev = valueC;
         }
         else if(!strcmp(name, "numberGainRegisters"))
         {
             double valueC = atof(value);
-            simulationSettings.numberGainRegisters = valueC;
+            context->settings.numberGainRegisters = valueC;
         }
         else if(!strcmp(name, "p0"))
         {
             double valueC = atof(value);
-            simulationSettings.p0 = valueC;
+            context->settings.p0 = valueC;
         }
         else if(!strcmp(name, "scatteringRate"))
         {
             double valueC = atof(value);
-            simulationSettings.scatteringRate = valueC;
+            context->settings.scatteringRate = valueC;
         }
         else if(!strcmp(name, "exposureTime"))
         {
             double valueC = atof(value);
-            simulationSettings.exposureTime = valueC;
+            context->settings.exposureTime = valueC;
         }
         else if(!strcmp(name, "survivalProbability"))
         {
             double valueC = atof(value);
-            simulationSettings.survivalProbability = valueC;
+            context->settings.survivalProbability = valueC;
         }
         else if(!strcmp(name, "fillingRatio"))
         {
             double valueC = atof(value);
-            simulationSettings.fillingRatio = valueC;
+            context->settings.fillingRatio = valueC;
         }
         else if(!strcmp(name, "lightSourceStdev"))
         {
             double valueC = atof(value);
-            simulationSettings.lightSourceStdev = valueC;
+            context->settings.lightSourceStdev = valueC;
+        }
+        else if(!strcmp(name, "lightSourceCutoff"))
+        {
+            double valueC = atof(value);
+            context->settings.lightSourceCutoff = valueC;
+        }
+        else if(!strcmp(name, "pixelIntegration"))
+        {
+            int valueC = atoi(value);
+            context->settings.pixelIntegration = valueC;
         }
         else if(!strcmp(name, "binning"))
         {
             int valueC = atoi(value);
-            simulationSettings.binning = valueC;
+            context->settings.binning = valueC;
         }
         else if(!strcmp(name, "resolution"))
         {
             int valueX = atoi(strtok(value, ", "));
             int valueY = atoi(strtok(NULL, ", "));
-            simulationSettings.resolutionX = valueX;
-            simulationSettings.resolutionY = valueY;
+            context->settings.resolutionX = valueX;
+            context->settings.resolutionY = valueY;
         }
         else if(!strcmp(name, "zernikeCoefficients"))
         {
@@ -201,153 +216,326 @@ EXPORT void readConfig(const char *path)
             for(int index = 0; index < 15 && valueZ; index++)
             {
                 double zernikeValue = atof(valueZ);
-                simulationSettings.zernikeCoefficients[index] = zernikeValue;
+                context->settings.zernikeCoefficients[index] = zernikeValue;
                 valueZ = strtok(NULL, ", ");
             }
         }
     }
     fclose(file);
+    invalidateOpticalTransferFunction(context);
+    return 1;
+}
+
+int readConfig(const char *path)
+{
+    return readConfigCtx(getDefaultSimContext(), path);
+}
+
+void setStrayLightRateCtx(SimContext *context, double val)
+{
+    context->settings.strayLightRate = val;
 }
 
 void setStrayLightRate(double val)
 {
-    simulationSettings.strayLightRate = val;
+    setStrayLightRateCtx(getDefaultSimContext(), val);
+}
+
+void setDarkCurrentRateCtx(SimContext *context, double val)
+{
+    context->settings.darkCurrentRate = val;
 }
 
 void setDarkCurrentRate(double val)
 {
-    simulationSettings.darkCurrentRate = val;
+    setDarkCurrentRateCtx(getDefaultSimContext(), val);
+}
+
+void setDarkCurrentSamplingAlphaCtx(SimContext *context, double val)
+{
+    context->settings.darkCurrentSamplingAlpha = val;
 }
 
 void setDarkCurrentSamplingAlpha(double val)
 {
-    simulationSettings.darkCurrentSamplingAlpha = val;
+    setDarkCurrentSamplingAlphaCtx(getDefaultSimContext(), val);
+}
+
+void setDarkCurrentSamplingBetaCtx(SimContext *context, double val)
+{
+    context->settings.darkCurrentSamplingBeta = val;
 }
 
 void setDarkCurrentSamplingBeta(double val)
 {
-    simulationSettings.darkCurrentSamplingBeta = val;
+    setDarkCurrentSamplingBetaCtx(getDefaultSimContext(), val);
+}
+
+void setCicChanceCtx(SimContext *context, double val)
+{
+    context->settings.cicChance = val;
 }
 
 void setCicChance(double val)
 {
-    simulationSettings.cicChance = val;
+    setCicChanceCtx(getDefaultSimContext(), val);
+}
+
+void setQuantumEfficiencyCtx(SimContext *context, double val)
+{
+    context->settings.quantumEfficiency = val;
 }
 
 void setQuantumEfficiency(double val)
 {
-    simulationSettings.quantumEfficiency = val;
+    setQuantumEfficiencyCtx(getDefaultSimContext(), val);
+}
+
+void setWavelengthCtx(SimContext *context, double val)
+{
+    context->settings.wavelength = val;
+    invalidateOpticalTransferFunction(context);
 }
 
 void setWavelength(double val)
 {
-    simulationSettings.wavelength = val;
+    setWavelengthCtx(getDefaultSimContext(), val);
+}
+
+void setNumericalApertureCtx(SimContext *context, double val)
+{
+    context->settings.numericalAperture = val;
+    invalidateOpticalTransferFunction(context);
 }
 
 void setNumericalAperture(double val)
 {
-    simulationSettings.numericalAperture = val;
+    setNumericalApertureCtx(getDefaultSimContext(), val);
+}
+
+void setPhysicalPixelSizeCtx(SimContext *context, double val)
+{
+    context->settings.physicalPixelSize = val;
+    context->settings.pixelSize = val / context->settings.magnification;
+    invalidateOpticalTransferFunction(context);
 }
 
 void setPhysicalPixelSize(double val)
 {
-    simulationSettings.physicalPixelSize = val;
-    simulationSettings.pixelSize = val / simulationSettings.magnification;
+    setPhysicalPixelSizeCtx(getDefaultSimContext(), val);
+}
+
+void setMagnificationCtx(SimContext *context, double val)
+{
+    context->settings.magnification = val;
+    context->settings.pixelSize = context->settings.physicalPixelSize / val;
+    invalidateOpticalTransferFunction(context);
 }
 
 void setMagnification(double val)
 {
-    simulationSettings.magnification = val;
-    simulationSettings.pixelSize = simulationSettings.physicalPixelSize / val;
+    setMagnificationCtx(getDefaultSimContext(), val);
+}
+
+void setBiasClampCtx(SimContext *context, double val)
+{
+    context->settings.biasClamp = val;
 }
 
 void setBiasClamp(double val)
 {
-    simulationSettings.biasClamp = val;
+    setBiasClampCtx(getDefaultSimContext(), val);
+}
+
+void setBiasStdevCtx(SimContext *context, double val)
+{
+    context->settings.biasStdev = val;
 }
 
 void setBiasStdev(double val)
 {
-    simulationSettings.biasStdev = val;
+    setBiasStdevCtx(getDefaultSimContext(), val);
+}
+
+void setRowNoiseStdevCtx(SimContext *context, double val)
+{
+    context->settings.rowNoiseStdev = val;
 }
 
 void setRowNoiseStdev(double val)
 {
-    simulationSettings.rowNoiseStdev = val;
+    setRowNoiseStdevCtx(getDefaultSimContext(), val);
+}
+
+void setColumnNoiseScaleCtx(SimContext *context, double val)
+{
+    context->settings.columnNoiseScale = val;
 }
 
 void setColumnNoiseScale(double val)
 {
-    simulationSettings.columnNoiseScale = val;
+    setColumnNoiseScaleCtx(getDefaultSimContext(), val);
+}
+
+void setFlickerNoiseScaleCtx(SimContext *context, double val)
+{
+    context->settings.flickerNoiseScale = val;
 }
 
 void setFlickerNoiseScale(double val)
 {
-    simulationSettings.flickerNoiseScale = val;
+    setFlickerNoiseScaleCtx(getDefaultSimContext(), val);
+}
+
+void setPreampgainCtx(SimContext *context, double val)
+{
+    context->settings.preampgain = val;
 }
 
 void setPreampgain(double val)
 {
-    simulationSettings.preampgain = val;
+    setPreampgainCtx(getDefaultSimContext(), val);
+}
+
+void setSCICChanceCtx(SimContext *context, double val)
+{
+    context->settings.sCICChance = val;
 }
 
 void setSCICChance(double val)
 {
-    simulationSettings.sCICChance = val;
+    setSCICChanceCtx(getDefaultSimContext(), val);
+}
+
+void setReadoutStdevCtx(SimContext *context, double val)
+{
+    context->settings.readoutStdev = val;
 }
 
 void setReadoutStdev(double val)
 {
-    simulationSettings.readoutStdev = val;
+    setReadoutStdevCtx(getDefaultSimContext(), val);
+}
+
+void setNumberGainRegistersCtx(SimContext *context, double val)
+{
+    context->settings.numberGainRegisters = val;
 }
 
 void setNumberGainRegisters(double val)
 {
-    simulationSettings.numberGainRegisters = val;
+    setNumberGainRegistersCtx(getDefaultSimContext(), val);
+}
+
+void setP0Ctx(SimContext *context, double val)
+{
+    context->settings.p0 = val;
 }
 
 void setP0(double val)
 {
-    simulationSettings.p0 = val;
+    setP0Ctx(getDefaultSimContext(), val);
+}
+
+void setScatteringRateCtx(SimContext *context, double val)
+{
+    context->settings.scatteringRate = val;
 }
 
 void setScatteringRate(double val)
 {
-    simulationSettings.scatteringRate = val;
+    setScatteringRateCtx(getDefaultSimContext(), val);
+}
+
+void setExposureTimeCtx(SimContext *context, double val)
+{
+    context->settings.exposureTime = val;
 }
 
 void setExposureTime(double val)
 {
-    simulationSettings.exposureTime = val;
+    setExposureTimeCtx(getDefaultSimContext(), val);
+}
+
+void setSurvivalProbabilityCtx(SimContext *context, double val)
+{
+    context->settings.survivalProbability = val;
 }
 
 void setSurvivalProbability(double val)
 {
-    simulationSettings.survivalProbability = val;
+    setSurvivalProbabilityCtx(getDefaultSimContext(), val);
+}
+
+void setFillingRatioCtx(SimContext *context, double val)
+{
+    context->settings.fillingRatio = val;
 }
 
 void setFillingRatio(double val)
 {
-    simulationSettings.fillingRatio = val;
+    setFillingRatioCtx(getDefaultSimContext(), val);
+}
+
+void setLightSourceStdevCtx(SimContext *context, double val)
+{
+    context->settings.lightSourceStdev = val;
 }
 
 void setLightSourceStdev(double val)
 {
-    simulationSettings.lightSourceStdev = val;
+    setLightSourceStdevCtx(getDefaultSimContext(), val);
+}
+
+void setLightSourceCutoffCtx(SimContext *context, double val)
+{
+    context->settings.lightSourceCutoff = val;
+}
+
+void setLightSourceCutoff(double val)
+{
+    setLightSourceCutoffCtx(getDefaultSimContext(), val);
+}
+
+void setPixelIntegrationCtx(SimContext *context, int val)
+{
+    context->settings.pixelIntegration = val;
+}
+
+void setPixelIntegration(int val)
+{
+    setPixelIntegrationCtx(getDefaultSimContext(), val);
+}
+
+void setBinningCtx(SimContext *context, int val)
+{
+    context->settings.binning = val;
 }
 
 void setBinning(int val)
 {
-    simulationSettings.binning = val;
+    setBinningCtx(getDefaultSimContext(), val);
+}
+
+void setResolutionCtx(SimContext *context, int x, int y)
+{
+    context->settings.resolutionX = x;
+    context->settings.resolutionY = y;
+    invalidateOpticalTransferFunction(context);
 }
 
 void setResolution(int x, int y)
 {
-    simulationSettings.resolutionX = x;
-    simulationSettings.resolutionY = y;
+    setResolutionCtx(getDefaultSimContext(), x, y);
+}
+
+void setZernikeCoefficientsCtx(SimContext *context, const double val[15])
+{
+    memcpy(context->settings.zernikeCoefficients, val, 15 * sizeof(double));
+    invalidateOpticalTransferFunction(context);
 }
 
 void setZernikeCoefficients(const double val[15])
 {
-    memcpy(simulationSettings.zernikeCoefficients, val, 15 * sizeof(double));
+    setZernikeCoefficientsCtx(getDefaultSimContext(), val);
 }
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simContext.h"
+#include "platformThreads.h"
+
+static SimContext defaultContext;
+static platformOnce defaultContextOnce = PLATFORM_ONCE_INITIALIZER;
+
+static void initSimContext(SimContext *context)
+{
+    static atomicCounter contextCount = 0;
+    memset(context, 0, sizeof(SimContext));
+    context->settings = defaultSettings;
+    // Not reproducible unless a seed is set explicitly
+    context->seed = (uint64_t)time(NULL) ^ (uint64_t)(size_t)context ^ ((uint64_t)(atomicFetchIncrement(&contextCount) + 1) << 32);
+}
+
+static void initDefaultSimContext()
+{
+    initSimContext(&defaultContext);
+}
+
+// The frame functions have no way to report a failed allocation, so running out of memory for the caches and workspaces ends the process
+void *requireAllocation(void *data, size_t size)
+{
+    if(!data && size)
+    {
+        fprintf(stderr, "Could not allocate %zu bytes for the simulation\n", size);
+        abort();
+    }
+    return data;
+}
+
+static void freeWorkspaceBuffer(workspaceBuffer *buffer)
+{
+    FFTW(free)(buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+static void freeWorkspace(workspace *workspace)
+{
+    freeWorkspaceBuffer(&workspace->image);
+    freeWorkspaceBuffer(&workspace->fftImage);
+    freeWorkspaceBuffer(&workspace->spectrum);
+    freeWorkspaceBuffer(&workspace->atomLocations);
+    freeWorkspaceBuffer(&workspace->siteIndices);
+    freeWorkspaceBuffer(&workspace->normalizedAtomLocations);
+    freeWorkspaceBuffer(&workspace->columnNoises);
+    freeWorkspaceBuffer(&workspace->readoutNoise);
+    freeWorkspaceBuffer(&workspace->lightSourceFactors);
+}
+
+static void freeZernikeBasis(zernikeBasisCache *cache)
+{
+    free(cache->pixelIndices);
+    free(cache->terms);
+    freeWorkspaceBuffer(&cache->pupilValues);
+}
+
+static size_t getZernikeBasisSize(const zernikeBasisCache *cache)
+{
+    return cache->pixelCapacity * (sizeof(int) + 15 * sizeof(double)) + cache->pupilValues.capacity;
+}
+
+static size_t getWorkspaceSize(const workspace *workspace)
+{
+    return workspace->image.capacity + workspace->fftImage.capacity + workspace->spectrum.capacity + 
+        workspace->atomLocations.capacity + workspace->siteIndices.capacity + workspace->normalizedAtomLocations.capacity + 
+        workspace->columnNoises.capacity + workspace->readoutNoise.capacity + workspace->lightSourceFactors.capacity;
+}
+
+// Buffers are allocated with fftw_malloc (fftwf_malloc in single precision) so that all of them can be handed to the cached FFTW plans
+void *reserveWorkspaceBuffer(workspaceBuffer *buffer, size_t size)
+{
+    if(size > buffer->capacity)
+    {
+        FFTW(free)(buffer->data);
+        buffer->data = requireAllocation(FFTW(malloc)(size), size);
+        buffer->capacity = size;
+    }
+    return buffer->data;
+}
+
+// Workspaces of the batch worker threads, kept so later batches do not have to allocate again
+workspace *reserveThreadWorkspaces(SimContext *context, int count)
+{
+    if(count > context->threadWorkspaceCount)
+    {
+        context->threadWorkspaces = realloc(context->threadWorkspaces, count * sizeof(workspace));
+        memset(context->threadWorkspaces + context->threadWorkspaceCount, 0, (count - context->threadWorkspaceCount) * sizeof(workspace));
+        context->threadWorkspaceCount = count;
+    }
+    return context->threadWorkspaces;
+}
+
+SimContext *createSimContext()
+{
+    SimContext *context = malloc(sizeof(SimContext));
+    if(!context)
+    {
+        return NULL;
+    }
+    initSimContext(context);
+    return context;
+}
+
+void freeSimContext(SimContext *context)
+{
+    if(!context)
+    {
+        return;
+    }
+    FFTW(free)(context->opticalTransferFunction.mtf);
+    freeZernikeBasis(&context->mtfZernikeBasis);
+    freeZernikeBasis(&context->psfZernikeBasis);
+    freeWorkspace(&context->workspace);
+    for(int t = 0; t < context->threadWorkspaceCount; t++)
+    {
+        freeWorkspace(&context->threadWorkspaces[t]);
+    }
+    free(context->threadWorkspaces);
+    free(context);
+}
+
+// Same settings, seed, frame index and thread count, but caches and workspaces of its own, so it can be used concurrently with the original
+SimContext *copySimContext(const SimContext *context)
+{
+    SimContext *copy = createSimContext();
+    if(!copy)
+    {
+        return NULL;
+    }
+    copy->settings = context->settings;
+    copy->seed = context->seed;
+    copy->frameIndex = context->frameIndex;
+    copy->threadCount = context->threadCount;
+    return copy;
+}
+
+// Context used by the functions without a context parameter, these may be called from several threads first
+SimContext *getDefaultSimContext()
+{
+    runOnce(&defaultContextOnce, initDefaultSimContext);
+    return &defaultContext;
+}
+
+// Setting the seed restarts the frame sequence, so the same seed always yields the same images
+void setSeedCtx(SimContext *context, uint64_t seed)
+{
+    context->seed = seed;
+    context->frameIndex = 0;
+}
+
+void setSeed(uint64_t seed)
+{
+    setSeedCtx(getDefaultSimContext(), seed);
+}
+
+// Frames are independent of each other, so e.g. frame 1000 can be generated without frames 0 to 999
+void setFrameIndexCtx(SimContext *context, uint64_t frameIndex)
+{
+    context->frameIndex = frameIndex;
+}
+
+void setFrameIndex(uint64_t frameIndex)
+{
+    setFrameIndexCtx(getDefaultSimContext(), frameIndex);
+}
+
+uint64_t getFrameIndexCtx(const SimContext *context)
+{
+    return context->frameIndex;
+}
+
+void setThreadCountCtx(SimContext *context, int threadCount)
+{
+    context->threadCount = threadCount;
+}
+
+void setThreadCount(int threadCount)
+{
+    setThreadCountCtx(getDefaultSimContext(), threadCount);
+}
+
+int getBatchThreadCount(const SimContext *context)
+{
+    if(context->threadCount > 0)
+    {
+        return context->threadCount;
+    }
+    int processorCount = getProcessorCount();
+    return processorCount > 0 ? processorCount : 1;
+}
+
+int usesSinglePrecision()
+{
+    return sizeof(real) == sizeof(float);
+}
+
+// Bytes held by the workspaces and the optical caches, these only grow, so this is also the peak
+size_t getPeakMemoryCtx(const SimContext *context)
+{
+    size_t size = getWorkspaceSize(&context->workspace);
+    for(int t = 0; t < context->threadWorkspaceCount; t++)
+    {
+        size += getWorkspaceSize(&context->threadWorkspaces[t]);
+    }
+    const otfCache *cache = &context->opticalTransferFunction;
+    if(cache->mtf)
+    {
+        size += cache->imageHeight * (cache->imageWidth / 2 + 1) * sizeof(real);
+    }
+    size += getZernikeBasisSize(&context->mtfZernikeBasis) + getZernikeBasisSize(&context->psfZernikeBasis);
+    return size;
+}
+
+size_t getPeakMemory()
+{
+    return getPeakMemoryCtx(getDefaultSimContext());
+}
+
+int usesFrameStats()
+{
+#ifdef NAIS_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void addFrameStats(frameStats *total, const frameStats *stats)
+{
+    total->frames += stats->frames;
+    total->frameSeconds += stats->frameSeconds;
+    total->lightSourceSeconds += stats->lightSourceSeconds;
+    total->opticsSeconds += stats->opticsSeconds;
+    total->fftSeconds += stats->fftSeconds;
+    total->photonSeconds += stats->photonSeconds;
+    total->readoutSeconds += stats->readoutSeconds;
+    total->poissonDraws += stats->poissonDraws;
+    total->emGainSamples += stats->emGainSamples;
+    total->sCICEvents += stats->sCICEvents;
+}
+
+frameStats getLastFrameStatsCtx(const SimContext *context)
+{
+    return context->lastFrameStats;
+}
+
+frameStats getLastFrameStats()
+{
+    return getLastFrameStatsCtx(getDefaultSimContext());
+}
+
+frameStats getCumulativeStatsCtx(const SimContext *context)
+{
+    return context->cumulativeStats;
+}
+
+frameStats getCumulativeStats()
+{
+    return getCumulativeStatsCtx(getDefaultSimContext());
+}
+
+void resetCumulativeStatsCtx(SimContext *context)
+{
+    memset(&context->cumulativeStats, 0, sizeof(frameStats));
+}
+
+void resetCumulativeStats()
+{
+    resetCumulativeStatsCtx(getDefaultSimContext());
+}
\ No newline at end of file